@@ -1,11 +1,34 @@
 #include <raylib.h>
+#include <rlgl.h>
 #include <algorithm>
+#include <cstdint>
 #include <vector>
+#include <functional>
 #include <memory>
 #include <cstdlib>
 #include <ctime>
 #include <cmath>
+#include <cfloat>
 #include <iostream>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <new>
+#include <cstdio>
+#include <string>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
 
 constexpr int SCREEN_WIDTH = 1600;
 constexpr int SCREEN_HEIGHT = 700;
@@ -16,6 +39,130 @@ constexpr float VEHICLE_HEIGHT = 40.0f;
 constexpr float SAFE_DISTANCE = 45.0f;
 constexpr int ROAD_Y_TOP = 110;
 constexpr int ROAD_Y_BOTTOM = 280;
+constexpr int TARGET_FPS = 60;
+constexpr float ENTRY_LINK_LENGTH = 600.0f; // Off-screen road before each spawn point
+constexpr int MAX_FREE_FLOW_FRAMES = 30; // Longest gap between leader checks for a free-flowing car
+constexpr size_t PARALLEL_MIN_VEHICLES = 2048; // Below this a road is updated on one thread
+constexpr size_t POOL_QUEUE_RESERVED = 64; // Task slots per worker queue before it has to grow
+constexpr size_t STEP_RESERVED_VEHICLES = 256; // Per road: vehicle lists, snapshots and spare cars set up by Init
+constexpr size_t STEP_RESERVED_EVENTS = 64; // Event, entry-link and road-process queues set up by Init
+constexpr double ROAD_LOOKAHEAD = 10.0; // Seconds a road's event process may run ahead of the frame clock
+constexpr int CA_VMAX = 5; // Cellular mode top speed, in cells per step
+constexpr float CAMERA_MIN_ZOOM = 0.1f;
+constexpr float CAMERA_MAX_ZOOM = 2.0f;
+constexpr float LOD_SPRITE_ZOOM = 0.6f; // Sprites at or above this zoom
+constexpr float LOD_QUAD_ZOOM = 0.25f;  // Flat quads down to this zoom, lane density strips below it
+constexpr float LOD_CHUNK_WIDTH = 200.0f; // Lane chunks share one LOD decision
+constexpr float LOD_WORLD_MIN_X = -400.0f;
+constexpr int CAPTURE_MAX_IN_FLIGHT = 8; // Frames read back but not yet encoded before capture waits
+constexpr const char* CAPTURE_FORMAT = ".qoi"; // Much faster to encode than PNG
+constexpr double FRAME_BUDGET_MS = 1000.0 / TARGET_FPS;
+constexpr int GOVERNOR_DEGRADE_FRAMES = 30;    // Frames over budget before shedding more work
+constexpr int GOVERNOR_RECOVER_FRAMES = 180;   // Frames with room to spare before restoring detail
+constexpr double GOVERNOR_RECOVER_RATIO = 0.6; // "Room to spare": under this share of the budget
+constexpr int LOD_CHUNKS = (int)((SCREEN_WIDTH + 400.0f - LOD_WORLD_MIN_X) / LOD_CHUNK_WIDTH);
+constexpr int TSD_COLUMNS = 480;     // Time-space diagram window, in steps
+constexpr int TSD_BAND_HEIGHT = 40;  // Rows per lane
+constexpr Color TSD_BACKGROUND = { 230, 230, 230, 255 };
+constexpr const char* METRICS_CSV_FILE = "metrics.csv";
+constexpr int ENV_OBS_SIZE = 16;  // Per lane queue and occupancy, then per light red flag and seconds in phase
+constexpr float ENV_LANE_CAPACITY = (SCREEN_WIDTH + 400.0f) / (VEHICLE_WIDTH + SAFE_DISTANCE);
+constexpr float HEAT_BIN_WIDTH = 150.0f;  // Lane segment per heatmap bin
+constexpr int HEAT_BINS = (int)((SCREEN_WIDTH + 400.0f - LOD_WORLD_MIN_X) / HEAT_BIN_WIDTH);  // Per lane
+constexpr float HEAT_SMOOTHING = 0.02f;   // Share of the current value blended in per step
+constexpr float HEAT_FREE_SPEED = 2.0f;   // Mean speed shown as fully green
+
+// Heap allocation tracking. The replaced global operator new counts every
+// allocation against the calling thread's phase; main marks the phases of the
+// main thread and closes each frame. Pool workers stay in PHASE_OTHER.
+enum AllocPhase {
+    PHASE_OTHER,   // Startup, input handling, shutdown
+    PHASE_UPDATE,
+    PHASE_DRAW,
+    PHASE_COUNT
+};
+
+struct AllocFrameStats {
+    uint64_t count[PHASE_COUNT];
+    uint64_t bytes[PHASE_COUNT];
+};
+
+class AllocTracker {
+private:
+    static thread_local int phase;
+    static std::atomic<bool> forbidden;
+    static std::atomic<uint64_t> count[PHASE_COUNT];
+    static std::atomic<uint64_t> bytes[PHASE_COUNT];
+    static AllocFrameStats mark;
+    static AllocFrameStats last;
+
+public:
+    static void Record(size_t size) {
+        int p = phase;
+        count[p].fetch_add(1, std::memory_order_relaxed);
+        bytes[p].fetch_add(size, std::memory_order_relaxed);
+        if (p != PHASE_OTHER && forbidden.load(std::memory_order_relaxed)) {
+            // No iostream here: it could allocate again
+            fprintf(stderr, "Steady-state allocation of %zu bytes during %s\n", size, p == PHASE_UPDATE ? "update" : "draw");
+            abort();
+        }
+    }
+
+    static void SetPhase(AllocPhase p) { phase = p; }
+
+    // Once the simulation is warmed up, any update/draw allocation aborts the program
+    static void ForbidSteadyState(bool on) { forbidden = on; }
+
+    // Stores the counts since the previous call as the last frame's figures
+    static void EndFrame() {
+        for (int p = 0; p < PHASE_COUNT; ++p) {
+            uint64_t c = count[p].load(), b = bytes[p].load();
+            last.count[p] = c - mark.count[p];
+            last.bytes[p] = b - mark.bytes[p];
+            mark.count[p] = c;
+            mark.bytes[p] = b;
+        }
+    }
+
+    static const AllocFrameStats& LastFrame() { return last; }
+};
+
+thread_local int AllocTracker::phase = PHASE_OTHER;
+std::atomic<bool> AllocTracker::forbidden{false};
+std::atomic<uint64_t> AllocTracker::count[PHASE_COUNT];
+std::atomic<uint64_t> AllocTracker::bytes[PHASE_COUNT];
+AllocFrameStats AllocTracker::mark = {};
+AllocFrameStats AllocTracker::last = {};
+
+void* operator new(size_t size) {
+    AllocTracker::Record(size);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+
+// Every delete goes through this one out-of-line call. When free() is inlined
+// into a delete, GCC pairs it with operator new and warns about a mismatch.
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void FreeTracked(void* p) noexcept { free(p); }
+
+void operator delete(void* p) noexcept { FreeTracked(p); }
+void operator delete[](void* p) noexcept { FreeTracked(p); }
+void operator delete(void* p, size_t) noexcept { FreeTracked(p); }
+void operator delete[](void* p, size_t) noexcept { FreeTracked(p); }
+
+// Direction-specialised helpers. Each road has a fixed travel direction,
+// so its loops pick the right instance at compile time instead of testing dirRight.
+template <bool DirRight>
+struct Heading {
+    // Distance from 'from' to 'to' along the travel direction (positive = ahead)
+    static float Ahead(float from, float to) { return DirRight ? to - from : from - to; }
+    static float Step(float speed) { return DirRight ? speed : -speed; }
+    static bool OffScreen(float x) { return DirRight ? x > SCREEN_WIDTH + 200 : x < -200; }
+    static float SpriteRotation() { return DirRight ? 90.0f : -90.0f; }
+};
 
 // Enum for Ambulance State Machine
 enum AmbulanceState {
@@ -27,6 +174,53 @@ enum AmbulanceState {
     LEAVING
 };
 
+// Enum for Tow Truck State Machine
+enum DepannageState {
+    TOW_TO_ACCIDENT,
+    TOW_WORKING,
+    TOW_LEAVING
+};
+
+// Service vehicle state tables.
+// Each row says how the vehicle moves while in that state and what ends it.
+enum AgentMotion {
+    MOTION_PATROL,  // Normal traffic behaviour
+    MOTION_DRIVE,   // Drive towards the stop point of the row
+    MOTION_HOLD,    // Stay in place
+    MOTION_LEAVE    // Drive off screen
+};
+
+enum AgentGuard {
+    GUARD_NONE,     // Never leaves the state on its own
+    GUARD_REACHED,  // Stop point reached
+    GUARD_TIMER     // Time spent in the state
+};
+
+struct AgentTransition {
+    AgentMotion motion;
+    AgentGuard guard;
+    float param;      // Stop offset for GUARD_REACHED, seconds for GUARD_TIMER
+    bool fromTarget;  // Stop offset is relative to the assigned target (else to x = 0)
+    int next;
+};
+
+// Rows are indexed by AmbulanceState
+constexpr AgentTransition AMBULANCE_TABLE[] = {
+    { MOTION_PATROL, GUARD_NONE,    0.0f,   false, PATROL },
+    { MOTION_DRIVE,  GUARD_REACHED, 160.0f, true,  WAIT_AT_ACCIDENT }, // Safe spot BEHIND accident
+    { MOTION_HOLD,   GUARD_TIMER,   5.0f,   false, TO_HOSPITAL },
+    { MOTION_DRIVE,  GUARD_REACHED, 80.0f,  false, WAIT_AT_HOSPITAL }, // Hospital (Left side)
+    { MOTION_HOLD,   GUARD_TIMER,   5.0f,   false, LEAVING },
+    { MOTION_LEAVE,  GUARD_NONE,    0.0f,   false, LEAVING }
+};
+
+// Rows are indexed by DepannageState
+constexpr AgentTransition DEPANNAGE_TABLE[] = {
+    { MOTION_DRIVE,  GUARD_REACHED, 180.0f, true,  TOW_WORKING },  // Stop slightly behind the accident
+    { MOTION_HOLD,   GUARD_TIMER,   2.0f,   false, TOW_LEAVING },  // Hooking up cars
+    { MOTION_LEAVE,  GUARD_NONE,    0.0f,   false, TOW_LEAVING }
+};
+
 class TrafficLight {
 private:
     Rectangle box;
@@ -49,229 +243,251 @@ public:
         DrawCircle((int)(box.x + 10), (int)(box.y + 15), 8.0f, red ? RED : Fade(RED, 0.3f));
         DrawCircle((int)(box.x + 10), (int)(box.y + 45), 8.0f, !red ? GREEN : Fade(GREEN, 0.3f));
     }
+    // Event-driven use: the owner schedules the changes instead of calling Update
+    void Toggle() {
+        timer = 0.0f;
+        red = !red;
+    }
+    float GetCycleTime() const { return cycleTime; }
     bool IsRed() const { return red; }
     float GetStopLineX(bool rightToLeft) const {
         return rightToLeft ? (box.x - 40) : (box.x + box.width + 40);
     }
 };
 
+// Vehicle state bits, packed into one word per vehicle
+enum VehicleFlag : uint16_t {
+    VF_MOVING          = 1 << 0,
+    VF_AMBULANCE       = 1 << 1,
+    VF_DEPANNAGE       = 1 << 2,
+    VF_DIR_RIGHT       = 1 << 3,
+    VF_CHANGED_LANE    = 1 << 4,
+    VF_FORCED_STOP     = 1 << 5,
+    VF_CRASHED         = 1 << 6,
+    VF_REMOVE          = 1 << 7,  // Delete on next cleanup
+    VF_RECKLESS        = 1 << 8,  // Will cause accident (Rear car)
+    VF_ACCIDENT_TARGET = 1 << 9,  // Victim of accident (Front car)
+    VF_TOWED           = 1 << 10, // Being pulled by tow truck
+    VF_LANE_LOCK       = 1 << 11  // Prevents lane changing during accidents
+};
+
+// Masks for the common filters
+constexpr uint16_t VF_IN_ACCIDENT = VF_RECKLESS | VF_ACCIDENT_TARGET | VF_CRASHED | VF_TOWED;
+constexpr uint16_t VF_NO_YIELD = VF_RECKLESS | VF_LANE_LOCK | VF_CHANGED_LANE;
+
 class Vehicle {
 protected:
     float x, y, targetY;
     float speed;
     Color color;
-    bool moving;
-    bool ambulance;
-    bool depannage; 
-    bool dirRight;
-    bool changedLane;
-    Texture2D texture{};
-    bool forcedStop;
-    
-public:
-    bool isCrashed; 
-    bool toBeRemoved; 
-    
-    // New flags for smooth mechanics
-    bool isReckless;        // Will cause accident (Rear car)
-    bool isAccidentTarget;  // Victim of accident (Front car)
-    bool isTowed;           // Being pulled by tow truck
-    bool laneLock;          // Prevents lane changing during accidents
-    float towOffsetX;       // Position relative to tow truck
+    uint16_t flags;
+    const Texture2D* texture = nullptr;  // Owned by the AssetCache, may not be resident yet
+    double wakeTime;  // Simulation time that ends the current timed state (0 = none)
+    double entryTime = 0.0;  // Simulation time the vehicle entered the network
+    int freeFlowFrames; // Frames left before the next leader/light check is needed
+    int heatBin = -1;        // Heatmap bin counted for this vehicle, -1 for none
+    float heatSpeed = 0.0f;  // Speed counted in that bin
+
+    // Lane changing smoothing
+    void SmoothLane() {
+        if (fabs(targetY - y) > 0.5f)
+            y += (targetY - y) * 0.08f;
+        else
+            y = targetY;
+    }
+
+    // Runs one frame of a service vehicle state table at simulation time 'now'.
+    // Timed states do not poll a clock: the owner schedules a wake event for
+    // GetWakeTime() and calls WakeStateTable when it fires.
+    // Returns true when the state changed this frame.
+    template <bool DirRight, typename State, size_t N>
+    bool StepStateTable(const AgentTransition (&table)[N], State& state, float target, double now, bool stopForRed) {
+        const AgentTransition& row = table[state];
+        bool done = false;
+
+        switch (row.motion) {
+            case MOTION_PATROL:
+                UpdateDir<DirRight>(stopForRed);
+                return false;
+            case MOTION_DRIVE:
+            case MOTION_LEAVE:
+                x += Heading<DirRight>::Step(speed);
+                break;
+            case MOTION_HOLD:
+                break;
+        }
+
+        if (row.guard == GUARD_REACHED) {
+            float stopX = (row.fromTarget ? target : 0.0f) + row.param;
+            done = Heading<DirRight>::Ahead(x, stopX) <= 0.0f;
+            if (done) x = stopX; // Snap to position
+        }
+
+        SmoothLane();
+
+        if (!done) return false;
+        EnterState(table, state, static_cast<State>(row.next), now);
+        return true;
+    }
 
+    // Ends a timed state whose deadline has passed. Returns true when the state changed.
+    template <typename State, size_t N>
+    bool WakeStateTable(const AgentTransition (&table)[N], State& state, double now) {
+        if (wakeTime <= 0.0 || now < wakeTime) return false;
+        EnterState(table, state, static_cast<State>(table[state].next), now);
+        return true;
+    }
+
+    template <typename State, size_t N>
+    void EnterState(const AgentTransition (&table)[N], State& state, State next, double now) {
+        state = next;
+        wakeTime = table[next].guard == GUARD_TIMER ? now + table[next].param : 0.0;
+    }
+
+public:
     Vehicle(float startX, float startY, float spd, Color col, bool dir = true, bool amb = false, bool dep = false)
-        : x(startX), y(startY), targetY(startY), speed(spd),
-        color(col), moving(true), ambulance(amb), depannage(dep), dirRight(dir), changedLane(false),
-        forcedStop(false), isCrashed(false), toBeRemoved(false),
-        isReckless(false), isAccidentTarget(false), isTowed(false), laneLock(false), towOffsetX(0.0f) {
+        : x(startX), y(startY), targetY(startY), speed(spd), color(col),
+        flags(VF_MOVING | (dir ? VF_DIR_RIGHT : 0) | (amb ? VF_AMBULANCE : 0) | (dep ? VF_DEPANNAGE : 0)),
+        wakeTime(0.0), freeFlowFrames(0) {
     }
-    virtual ~Vehicle() { UnloadTexture(texture); }
+    virtual ~Vehicle() = default;  // Textures belong to the AssetCache
     
-    virtual void Update(bool stopForRed = false) {
-        // Crashed cars do not move on their own
-        if (isCrashed && !isTowed) return;
-
-        // Towed logic handles position in Simulation update or here if we pass the parent, 
-        // but simple way: if isTowed, don't do normal movement
-        if (isTowed) return;
+    // Car behaviour for a known travel direction (used by the lane loops);
+    // service vehicles run their state table with UpdateService
+    template <bool DirRight>
+    void UpdateDir(bool stopForRed) {
+        // Crashed cars do not move on their own, towed cars are placed by their tow truck
+        if (Has(VF_CRASHED | VF_TOWED)) return;
 
         // Reckless drivers ignore red lights and speed up
-        if (isReckless) {
+        if (Has(VF_RECKLESS)) {
             stopForRed = false;
-            forcedStop = false;
+            flags &= ~VF_FORCED_STOP;
         }
 
-        if (moving && !stopForRed && !forcedStop) x += dirRight ? speed : -speed;
+        if ((flags & (VF_MOVING | VF_FORCED_STOP)) == VF_MOVING && !stopForRed) x += Heading<DirRight>::Step(speed);
         
-        // Lane changing smoothing
-        if (fabs(targetY - y) > 0.5f)
-            y += (targetY - y) * 0.08f;
-        else
-            y = targetY;
+        SmoothLane();
     }
 
-    virtual void Draw() const {
-        Rectangle source = { 0, 0, (float)texture.width, (float)texture.height };
+    // Flat rectangle in the vehicle's own colour: the medium LOD, and the placeholder
+    // until the sprite is uploaded
+    void DrawQuad() const {
+        DrawRectangleRec({ x, y, VEHICLE_WIDTH, VEHICLE_HEIGHT }, Has(VF_CRASHED) ? RED : color);
+    }
+
+    template <bool DirRight>
+    void Draw() const {
+        if (!texture || texture->id == 0) {
+            DrawQuad();
+            return;
+        }
+
+        Rectangle source = { 0, 0, (float)texture->width, (float)texture->height };
         Rectangle dest = { x + VEHICLE_WIDTH / 2, y + VEHICLE_HEIGHT / 2, VEHICLE_HEIGHT, VEHICLE_WIDTH };
         Vector2 origin = { VEHICLE_HEIGHT / 2, VEHICLE_WIDTH / 2 };
-        float rotation = dirRight ? 90.0f : -90.0f;
-        
+
         // If crash, tint red
         Color drawColor = WHITE;
-        if (isCrashed) drawColor = RED; 
+        if (Has(VF_CRASHED)) drawColor = RED; 
 
-        DrawTexturePro(texture, source, dest, origin, rotation, drawColor);
+        DrawTexturePro(*texture, source, dest, origin, Heading<DirRight>::SpriteRotation(), drawColor);
     }
 
-    bool IsOffScreen() const { return dirRight ? x > SCREEN_WIDTH + 200 : x < -200; }
-    bool IsAmbulance() const { return ambulance; }
-    bool IsDepannage() const { return depannage; }
+    template <bool DirRight>
+    bool IsOffScreen() const { return Heading<DirRight>::OffScreen(x); }
+    bool Has(uint16_t mask) const { return (flags & mask) != 0; }
+    void SetFlag(uint16_t mask, bool on) { flags = on ? (flags | mask) : (flags & ~mask); }
+    uint16_t GetFlags() const { return flags; }
     float GetX() const { return x; }
     float GetY() const { return y; }
     void SetX(float newX) { x = newX; }
     void SetY(float newY) { y = newY; }
     void SetSpeed(float s) { speed = s; }
     float GetSpeed() const { return speed; }
-    void SetMoving(bool state) { moving = state; }
-    bool IsMoving() const { return moving; }
+    void SetMoving(bool state) { SetFlag(VF_MOVING, state); }
+    bool IsMoving() const { return Has(VF_MOVING); }
     void SetTargetY(float newY) { targetY = newY; }
     float GetTargetY() const { return targetY; }
-    bool HasChangedLane() const { return changedLane; }
-    void SetChangedLane(bool v) { changedLane = v; }
-    void SetForcedStop(bool stop) { forcedStop = stop; }
-    bool IsForcedStop() const { return forcedStop; }
+    bool HasChangedLane() const { return Has(VF_CHANGED_LANE); }
+    void SetChangedLane(bool v) { SetFlag(VF_CHANGED_LANE, v); }
+    void SetForcedStop(bool stop) { SetFlag(VF_FORCED_STOP, stop); }
+    bool IsForcedStop() const { return Has(VF_FORCED_STOP); }
+    double GetEntryTime() const { return entryTime; }
+    void SetEntryTime(double t) { entryTime = t; }
+    int GetHeatBin() const { return heatBin; }
+    float GetHeatSpeed() const { return heatSpeed; }
+    void SetHeat(int bin, float spd) { heatBin = bin; heatSpeed = spd; }
+    int GetFreeFlowFrames() const { return freeFlowFrames; }
+    void SetFreeFlowFrames(int frames) { freeFlowFrames = frames; }
+    // Waiting on a timer with nothing else to do this frame
+    bool IsAsleep() const { return wakeTime > 0.0 && y == targetY; }
+    double GetWakeTime() const { return wakeTime; }
 };
 
-class Car : public Vehicle {
+class Car final : public Vehicle {
 public:
-    Car(float startX, float startY, float spd, Color col, bool dirRight = true, const char* imageFile = "car.png")
+    Car(float startX, float startY, float spd, Color col, bool dirRight, const Texture2D* tex)
         : Vehicle(startX, startY, spd, col, dirRight) {
-        texture = LoadTexture(imageFile);
+        texture = tex;
+    }
+
+    // Sends a parked car on a new trip, as if newly constructed
+    void Reset(float startX, float startY, float spd, Color col, bool dirRight, const Texture2D* tex) {
+        *this = Car(startX, startY, spd, col, dirRight, tex);
     }
 };
 
-class Ambulance : public Vehicle {
+class Ambulance final : public Vehicle {
 public:
     AmbulanceState state;
-    float stateTimer;
     float accidentX;
     float accidentY;
 
-    Ambulance(float startX, float startY, float spd, bool dirRight = false)
-        : Vehicle(startX, startY, spd, RAYWHITE, dirRight, true), 
-          state(PATROL), stateTimer(0.0f), accidentX(0), accidentY(0) {
-        texture = LoadTexture("ambulance.png");
+    // Drives right to left, like every service vehicle
+    Ambulance(float startX, float startY, float spd, const Texture2D* tex)
+        : Vehicle(startX, startY, spd, RAYWHITE, false, true), 
+          state(PATROL), accidentX(0), accidentY(0) {
+        texture = tex;
     }
 
-    void AssignAccident(float accX, float accY) {
+    void AssignAccident(float accX, float accY, double now) {
         accidentX = accX;
         accidentY = accY;
-        state = TO_ACCIDENT;
+        EnterState(AMBULANCE_TABLE, state, TO_ACCIDENT, now);
     }
 
-    void Update(bool stopForRed = false) override {
-        switch (state) {
-            case PATROL:
-                Vehicle::Update(stopForRed);
-                break;
-
-            case TO_ACCIDENT:
-                // Move towards accident
-                if (dirRight) x += speed; else x -= speed;
-                
-                // STOP LOGIC: strictly check if we reached the safe spot BEHIND accident
-                // Accident is at accidentX. We move Right->Left. Stop at accidentX + 160.
-                if (x <= accidentX + 160.0f) {
-                    x = accidentX + 160.0f; // Snap to position
-                    state = WAIT_AT_ACCIDENT;
-                    stateTimer = 0.0f;
-                }
-                break;
-
-            case WAIT_AT_ACCIDENT:
-                stateTimer += GetFrameTime();
-                if (stateTimer >= 5.0f) {
-                    state = TO_HOSPITAL;
-                }
-                break;
-
-            case TO_HOSPITAL:
-                // Move towards Hospital (Left side)
-                if (x > 80) {
-                    x -= speed; 
-                } else {
-                    state = WAIT_AT_HOSPITAL;
-                    stateTimer = 0.0f;
-                }
-                break;
-
-            case WAIT_AT_HOSPITAL:
-                stateTimer += GetFrameTime();
-                if (stateTimer >= 5.0f) {
-                    state = LEAVING;
-                }
-                break;
-
-            case LEAVING:
-                x -= speed; 
-                break;
-        }
-
-        // Lane smoothing
-        if (fabs(targetY - y) > 0.5f)
-             y += (targetY - y) * 0.08f;
-        else
-             y = targetY;
+    template <bool DirRight>
+    bool UpdateService(double now, bool stopForRed = false) {
+        return StepStateTable<DirRight>(AMBULANCE_TABLE, state, accidentX, now, stopForRed);
     }
+
+    bool Wake(double now) { return WakeStateTable(AMBULANCE_TABLE, state, now); }
 };
 
-class Depannage : public Vehicle {
+class Depannage final : public Vehicle {
 public:
-    bool hasPickedUp;
+    DepannageState state;
     float targetX;
-    float workTimer; 
-    bool isWorking;
 
-    Depannage(float startX, float startY, float spd)
+    Depannage(float startX, float startY, float spd, const Texture2D* tex)
         : Vehicle(startX, startY, spd, ORANGE, false, false, true), 
-          hasPickedUp(false), targetX(0), workTimer(0.0f), isWorking(false) {
-        texture = LoadTexture("depannage.png"); 
+          state(TOW_TO_ACCIDENT), targetX(0) {
+        texture = tex; 
     }
 
     void SetTarget(float tX) {
         targetX = tX;
     }
 
-    void Update(bool stopForRed = false) override {
-        if (!hasPickedUp) {
-            if (!isWorking) {
-                // Moving to accident
-                // Stop slightly behind where ambulance was (or accident)
-                if (x > targetX + 180) { 
-                    x -= speed;
-                } else {
-                    // Arrived, start working
-                    isWorking = true;
-                    workTimer = 0.0f;
-                }
-            } else {
-                // Simulation "Working" phase (Hooking up cars)
-                workTimer += GetFrameTime();
-                if (workTimer > 2.0f) {
-                    hasPickedUp = true;
-                    isWorking = false;
-                }
-            }
-        } else {
-            // Leave with cars
-            x -= speed;
-        }
+    bool HasPickedUp() const { return state == TOW_LEAVING; }
 
-         if (fabs(targetY - y) > 0.5f)
-             y += (targetY - y) * 0.08f;
-        else
-             y = targetY;
+    template <bool DirRight>
+    bool UpdateService(double now, bool stopForRed = false) {
+        return StepStateTable<DirRight>(DEPANNAGE_TABLE, state, targetX, now, stopForRed);
     }
+
+    bool Wake(double now) { return WakeStateTable(DEPANNAGE_TABLE, state, now); }
 };
 
 class Road {
@@ -286,37 +502,1407 @@ public:
             DrawLine(0, ROAD_Y_TOP + i * LANE_HEIGHT, SCREEN_WIDTH, ROAD_Y_TOP + i * LANE_HEIGHT, Fade(WHITE, 0.7f));
             DrawLine(0, ROAD_Y_BOTTOM + i * LANE_HEIGHT, SCREEN_WIDTH, ROAD_Y_BOTTOM + i * LANE_HEIGHT, Fade(WHITE, 0.7f));
         }
-        DrawRectangle(0, ROAD_Y_TOP - 20, SCREEN_WIDTH, 20, GRAY);
-        DrawRectangle(0, ROAD_Y_BOTTOM + ROAD_HEIGHT, SCREEN_WIDTH, 20, GRAY);
-        for (int i = 0; i < SCREEN_WIDTH; i += 80) {
-            DrawRectangle(i, ROAD_Y_TOP + (ROAD_HEIGHT / 2) - 3, 40, 6, YELLOW);
-            DrawRectangle(i, ROAD_Y_BOTTOM + (ROAD_HEIGHT / 2) - 3, 40, 6, YELLOW);
+        DrawRectangle(0, ROAD_Y_TOP - 20, SCREEN_WIDTH, 20, GRAY);
+        DrawRectangle(0, ROAD_Y_BOTTOM + ROAD_HEIGHT, SCREEN_WIDTH, 20, GRAY);
+        for (int i = 0; i < SCREEN_WIDTH; i += 80) {
+            DrawRectangle(i, ROAD_Y_TOP + (ROAD_HEIGHT / 2) - 3, 40, 6, YELLOW);
+            DrawRectangle(i, ROAD_Y_BOTTOM + (ROAD_HEIGHT / 2) - 3, 40, 6, YELLOW);
+        }
+    }
+};
+
+// Ring buffer, oldest element first. Push overwrites the oldest element when
+// full, PushGrow doubles the storage instead. Storage is only allocated up
+// front, by Reserve and by PushGrow, so a ring that has reached its working
+// size never touches the heap again.
+template <typename T>
+class Ring {
+private:
+    std::vector<T> items;
+    size_t head = 0;  // Next slot written
+    size_t count = 0;
+
+    size_t Slot(size_t i) const { return (head + items.size() - count + i) % items.size(); }
+
+    void Resize(size_t capacity) {
+        std::vector<T> bigger(capacity);
+        for (size_t i = 0; i < count; ++i) bigger[i] = std::move(items[Slot(i)]);
+        items.swap(bigger);
+        head = count;
+    }
+
+public:
+    explicit Ring(size_t capacity = 0) : items(capacity) {}
+
+    // Needs a capacity above 0
+    void Push(T item) {
+        items[head] = std::move(item);
+        head = (head + 1) % items.size();
+        if (count < items.size()) ++count;
+    }
+
+    void PushGrow(T item) {
+        if (count == items.size()) Resize(std::max<size_t>(1, items.size() * 2));
+        Push(std::move(item));
+    }
+
+    void Reserve(size_t capacity) {
+        if (capacity > items.size()) Resize(capacity);
+    }
+
+    T& Front() { return items[Slot(0)]; }
+    T& Back() { return items[Slot(count - 1)]; }
+
+    // Drop the oldest or the newest element
+    void PopFront() { --count; }
+    void PopBack() {
+        --count;
+        head = (head + items.size() - 1) % items.size();
+    }
+
+    bool Empty() const { return count == 0; }
+    size_t Size() const { return count; }
+    const T& operator[](size_t i) const { return items[Slot(i)]; }
+
+    // First element whose key is >= 'key', for keys that never decrease
+    template <typename Key>
+    size_t LowerBound(double key, Key keyOf) const {
+        size_t lo = 0, hi = count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (keyOf((*this)[mid]) < key) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+};
+
+// Task priorities, highest first. Workers always drain a higher level
+// (their own or stolen) before touching a lower one.
+enum TaskPriority {
+    PRIORITY_SIM,      // Simulation step phases
+    PRIORITY_IO,       // Asset loading, recording and metrics export
+    PRIORITY_COUNT
+};
+
+// Work-stealing pool shared by every parallel feature.
+// Each worker has one deque per priority. Tasks submitted from a worker go on
+// its own deque, which it pops from the back (newest first) while idle workers
+// steal from the front (oldest first). Tasks from outside threads go to a shared
+// inbox that every worker serves before stealing. ParallelFor is the fork-join entry point
+// for update phases: chunk boundaries depend only on the input size, so results
+// are the same whichever worker runs which chunk.
+class TaskPool {
+public:
+    struct WorkerStats {
+        uint64_t executed;
+        uint64_t steals;
+        double idleSeconds;
+    };
+
+private:
+    struct Worker {
+        std::mutex lock;
+        Ring<std::function<void()>> tasks[PRIORITY_COUNT];
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> idleMicros{0};
+
+        Worker() {
+            for (auto& queue : tasks) queue.Reserve(POOL_QUEUE_RESERVED);
+        }
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    Worker inbox;  // Tasks submitted from outside the pool
+    std::vector<std::thread> threads;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::atomic<bool> stopping{false};
+    std::atomic<int> queued{0};
+
+    // Set on pool threads, so Submit can find the caller's own deque
+    static thread_local const TaskPool* currentPool;
+    static thread_local size_t currentWorker;
+
+    bool Pop(Worker& w, int priority, bool back, std::function<void()>& task) {
+        std::lock_guard<std::mutex> guard(w.lock);
+        auto& queue = w.tasks[priority];
+        if (queue.Empty()) return false;
+        if (back) { task = std::move(queue.Back()); queue.PopBack(); }
+        else { task = std::move(queue.Front()); queue.PopFront(); }
+        return true;
+    }
+
+    // Runs one task of at most 'lowest' priority. 'self' is the worker index,
+    // or workers.size() for a thread outside the pool (it has no deque of its own).
+    bool RunOne(size_t self, int lowest) {
+        std::function<void()> task;
+        for (int p = 0; p <= lowest; ++p) {
+            bool stolen = false;
+            bool found = self < workers.size() && Pop(*workers[self], p, true, task);
+            if (!found) found = Pop(inbox, p, false, task);
+            for (size_t k = 1; !found && k <= workers.size(); ++k) {
+                size_t victim = (self + k) % workers.size();
+                if (victim == self) continue;
+                found = stolen = Pop(*workers[victim], p, false, task);
+            }
+            if (!found) continue;
+
+            queued--;
+            task();
+            if (self < workers.size()) {
+                workers[self]->executed++;
+                if (stolen) workers[self]->steals++;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void WorkerLoop(size_t self) {
+        currentPool = this;
+        currentWorker = self;
+        while (!stopping) {
+            if (RunOne(self, PRIORITY_COUNT - 1)) continue;
+            auto idleStart = std::chrono::steady_clock::now();
+            {
+                // Submit raises 'queued' under this lock, so no wakeup is missed
+                std::unique_lock<std::mutex> guard(sleepLock);
+                wake.wait(guard, [this] { return stopping || queued > 0; });
+            }
+            workers[self]->idleMicros += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - idleStart).count();
+        }
+    }
+
+public:
+    explicit TaskPool(unsigned threadCount = std::max(1u, std::thread::hardware_concurrency()) - 1) {
+        for (unsigned i = 0; i < threadCount; ++i) workers.push_back(std::make_unique<Worker>());
+        for (unsigned i = 0; i < threadCount; ++i) threads.emplace_back(&TaskPool::WorkerLoop, this, i);
+    }
+
+    ~TaskPool() {
+        // Finish what was queued (pending recordings etc.) before shutting down
+        while (queued > 0 && RunOne(workers.size(), PRIORITY_COUNT - 1)) {}
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    size_t WorkerCount() const { return workers.size(); }
+
+    void Submit(TaskPriority priority, std::function<void()> task) {
+        if (workers.empty()) { task(); return; }
+        Worker& w = currentPool == this ? *workers[currentWorker] : inbox;
+        {
+            std::lock_guard<std::mutex> guard(w.lock);
+            w.tasks[priority].PushGrow(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            queued++;
+        }
+        wake.notify_one();
+    }
+
+    // Calls body(begin, end) for 'chunks' equal slices of [0, n) and returns when
+    // all are done. The calling thread runs the first slice and then helps with
+    // simulation-priority work, never with lower-priority tasks.
+    void ParallelFor(size_t n, size_t chunks, const std::function<void(size_t, size_t)>& body) {
+        chunks = std::max<size_t>(1, std::min(chunks, n));
+        if (chunks == 1 || workers.empty()) { body(0, n); return; }
+
+        // Chunk tasks capture only this and their index, small enough for
+        // std::function to hold without a heap allocation
+        struct Job {
+            const std::function<void(size_t, size_t)>* body;
+            size_t n, chunks;
+            std::atomic<size_t> remaining;
+            void Run(size_t c) const { (*body)(n * c / chunks, n * (c + 1) / chunks); }
+        };
+        Job job;
+        job.body = &body;
+        job.n = n;
+        job.chunks = chunks;
+        job.remaining = chunks - 1;
+        for (size_t c = 1; c < chunks; ++c) Submit(PRIORITY_SIM, [&job, c] { job.Run(c); job.remaining--; });
+        job.Run(0);
+        while (job.remaining > 0) {
+            if (!RunOne(workers.size(), PRIORITY_SIM)) std::this_thread::yield();
+        }
+    }
+
+    WorkerStats GetStats(size_t i) const {
+        const Worker& w = *workers[i];
+        return { w.executed.load(), w.steals.load(), w.idleMicros.load() / 1e6 };
+    }
+};
+
+thread_local const TaskPool* TaskPool::currentPool = nullptr;
+thread_local size_t TaskPool::currentWorker = 0;
+
+// Bump allocator for data that only lives for one Simulation::Update.
+// Blocks are kept between steps (merged into one after a step that needed more),
+// so once warmed up a step never touches the heap for its scratch data.
+// Building with SIM_DEBUG fills released memory with 0xDD to catch stale pointers.
+class StepArena {
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t current = 0;  // Block being filled
+    size_t used = 0;     // Bytes used in the current block
+    size_t total = 0;    // Bytes handed out this step
+
+public:
+    explicit StepArena(size_t initialSize = 64 * 1024) {
+        blocks.push_back({ std::unique_ptr<char[]>(new char[initialSize]), initialSize });
+    }
+
+    void* Allocate(size_t bytes, size_t align) {
+        size_t offset = (used + align - 1) & ~(align - 1);
+        if (offset + bytes > blocks[current].size) {
+            if (current + 1 == blocks.size()) {
+                size_t size = std::max(blocks[current].size * 2, bytes + align);
+                blocks.push_back({ std::unique_ptr<char[]>(new char[size]), size });
+            }
+            current++;
+            used = 0;
+            offset = 0;
+        }
+        used = offset + bytes;
+        total += bytes;
+        return blocks[current].data.get() + offset;
+    }
+
+    // Releases everything allocated since the last Reset
+    void Reset() {
+#ifdef SIM_DEBUG
+        for (size_t b = 0; b <= current; ++b)
+            memset(blocks[b].data.get(), 0xDD, b == current ? used : blocks[b].size);
+#endif
+        if (current > 0) {
+            size_t size = 0;
+            for (auto& b : blocks) size += b.size;
+            blocks.clear();
+            blocks.push_back({ std::unique_ptr<char[]>(new char[size]), size });
+        }
+        current = 0;
+        used = 0;
+        total = 0;
+    }
+
+    size_t BytesThisStep() const { return total; }
+};
+
+// Standard allocator adapter so containers can take their storage from a StepArena.
+// Deallocation is a no-op: memory comes back all at once on Reset.
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+    StepArena* arena;
+
+    explicit ArenaAllocator(StepArena* a) : arena(a) {}
+    template <typename U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U> bool operator==(const ArenaAllocator<U>& o) const { return arena == o.arena; }
+    template <typename U> bool operator!=(const ArenaAllocator<U>& o) const { return arena != o.arena; }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Every texture and sound the simulation uses, loaded once at startup.
+// --pack-assets decodes them all into ASSET_PACK_FILE; when that file is present a
+// start is one file read plus GPU uploads, with no PNG/WAV decoding. Without it,
+// or when a source file changed since it was written, the loose files are decoded instead. Decoding runs on the task pool and the
+// uploads are spread over frames, so the window is responsive from the first frame.
+enum TextureId {
+    TEX_CAR, TEX_CARS, TEX_CAR2, TEX_CAR3, TEX_CAR4,  // Random car sprites
+    TEX_AMBULANCE,
+    TEX_DEPANNAGE,
+    TEX_HOSPITAL,
+    TEX_COUNT
+};
+constexpr int CAR_TEXTURE_COUNT = 5;
+constexpr const char* TEXTURE_FILES[TEX_COUNT] = {
+    "car.png", "cars.png", "car2.png", "car3.png", "car4.png", "ambulance.png", "depannage.png", "hospital.png"
+};
+
+enum SoundId {
+    SND_SIREN,
+    SND_COUNT
+};
+constexpr const char* SOUND_FILES[SND_COUNT] = { "siren.wav" };
+
+constexpr const char* ASSET_PACK_FILE = "assets.pack";
+constexpr uint32_t ASSET_PACK_MAGIC = 0x4B505354;  // "TSPK"
+constexpr uint32_t ASSET_PACK_VERSION = 2;
+constexpr double ASSET_UPLOAD_BUDGET_MS = 2.0;  // Render-thread time per frame for texture uploads
+
+class AssetCache {
+private:
+    // A file decoded on a worker, waiting for its GPU/audio upload on the render thread
+    struct Decoded {
+        bool isSound;
+        int index;
+        Image image;
+        Wave wave;
+    };
+
+    Texture2D textures[TEX_COUNT] = {};
+    Sound sounds[SND_COUNT] = {};
+    std::mutex readyLock;
+    std::vector<Decoded> ready;
+    std::atomic<int> outstanding{0};  // Assets not yet uploaded
+    std::chrono::steady_clock::time_point loadStart;
+
+    // Pack layout: magic, version, then every texture and sound in enum order.
+    // Each starts with its source file's size and modification time (low, high word).
+    // Texture: width, height, format, mipmaps, byte count, pixels.
+    // Sound: frame count, sample rate, sample size, channels, byte count, samples.
+    // A missing source file is stored with a byte count of 0.
+    struct Reader {
+        const unsigned char* at;
+        const unsigned char* end;
+        bool ok;
+
+        uint32_t U32() {
+            uint32_t v = 0;
+            if (end - at < 4) { ok = false; return 0; }
+            memcpy(&v, at, 4);
+            at += 4;
+            return v;
+        }
+        void* Copy(uint32_t n) {
+            if ((uint32_t)(end - at) < n) { ok = false; return nullptr; }
+            if (n == 0) return nullptr;
+            void* p = malloc(n);  // Released by UnloadImage/UnloadWave
+            memcpy(p, at, n);
+            at += n;
+            return p;
+        }
+    };
+
+    // True if the source file still has the size and time recorded in the pack
+    static bool SourceMatches(Reader& in, const char* file) {
+        uint32_t size = in.U32();
+        uint32_t timeLo = in.U32();
+        uint32_t timeHi = in.U32();
+        uint64_t time = ((uint64_t)timeHi << 32) | timeLo;
+        return in.ok && size == (uint32_t)GetFileLength(file) && time == (uint64_t)GetFileModTime(file);
+    }
+
+    // Byte counts that do not match the stored layout would make the upload read past the buffer
+    static uint32_t ImageBytes(const Image& img) {
+        if (img.width <= 0 || img.height <= 0 || img.format <= 0 || img.mipmaps != 1) return UINT32_MAX;
+        return (uint32_t)GetPixelDataSize(img.width, img.height, img.format);
+    }
+    static uint32_t WaveBytes(const Wave& wave) {
+        if (wave.sampleSize != 8 && wave.sampleSize != 16 && wave.sampleSize != 32) return UINT32_MAX;
+        return wave.frameCount * wave.channels * (wave.sampleSize / 8);
+    }
+
+    void Publish(const Decoded& d) {
+        std::lock_guard<std::mutex> guard(readyLock);
+        ready.push_back(d);
+    }
+
+    // Runs on a worker. Returns false if the pack is missing or damaged.
+    bool DecodePack() {
+        unsigned int size = 0;
+        unsigned char* blob = LoadFileData(ASSET_PACK_FILE, &size);
+        if (!blob) return false;
+
+        Reader in = { blob, blob + size, true };
+        std::vector<Decoded> items;
+        bool valid = in.U32() == ASSET_PACK_MAGIC && in.U32() == ASSET_PACK_VERSION;
+        bool stale = false;
+        for (int i = 0; valid && !stale && i < TEX_COUNT; ++i) {
+            stale = !SourceMatches(in, TEXTURE_FILES[i]);
+            Decoded d = { false, i, {}, {} };
+            d.image.width = (int)in.U32();
+            d.image.height = (int)in.U32();
+            d.image.format = (int)in.U32();
+            d.image.mipmaps = (int)in.U32();
+            uint32_t bytes = in.U32();
+            valid = in.ok && (bytes == 0 || bytes == ImageBytes(d.image));
+            if (valid) d.image.data = in.Copy(bytes);
+            items.push_back(d);
+            valid = valid && in.ok;
+        }
+        for (int i = 0; valid && !stale && i < SND_COUNT; ++i) {
+            stale = !SourceMatches(in, SOUND_FILES[i]);
+            Decoded d = { true, i, {}, {} };
+            d.wave.frameCount = in.U32();
+            d.wave.sampleRate = in.U32();
+            d.wave.sampleSize = in.U32();
+            d.wave.channels = in.U32();
+            uint32_t bytes = in.U32();
+            valid = in.ok && (bytes == 0 || bytes == WaveBytes(d.wave));
+            if (valid) d.wave.data = in.Copy(bytes);
+            items.push_back(d);
+            valid = valid && in.ok;
+        }
+        UnloadFileData(blob);
+
+        if (stale) std::cout << ASSET_PACK_FILE << " does not match the asset files, decoding those instead" << std::endl;
+        if (!valid || stale) {
+            for (auto& d : items) { free(d.image.data); free(d.wave.data); }
+            return false;
+        }
+        for (auto& d : items) Publish(d);
+        return true;
+    }
+
+public:
+    // Decodes every asset on the pool; nothing is resident until UploadReady runs
+    void StartLoading(TaskPool& pool) {
+        loadStart = std::chrono::steady_clock::now();
+        outstanding = TEX_COUNT + SND_COUNT;
+        pool.Submit(PRIORITY_IO, [this, &pool] {
+            if (DecodePack()) return;
+            // No usable pack: decode the loose files, one task each
+            for (int i = 0; i < TEX_COUNT; ++i)
+                pool.Submit(PRIORITY_IO, [this, i] { Publish({ false, i, LoadImage(TEXTURE_FILES[i]), {} }); });
+            for (int i = 0; i < SND_COUNT; ++i)
+                pool.Submit(PRIORITY_IO, [this, i] { Publish({ true, i, {}, LoadWave(SOUND_FILES[i]) }); });
+        });
+    }
+
+    // Render thread: uploads decoded assets until the time budget is spent (at least one per call)
+    void UploadReady(double budgetMs) {
+        if (outstanding == 0) return;
+        auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> guard(readyLock);
+        while (!ready.empty()) {
+            Decoded d = ready.back();
+            ready.pop_back();
+            guard.unlock();
+
+            if (d.isSound) {
+                if (d.wave.data) sounds[d.index] = LoadSoundFromWave(d.wave);
+                UnloadWave(d.wave);
+            } else {
+                if (d.image.data) textures[d.index] = LoadTextureFromImage(d.image);
+                UnloadImage(d.image);
+            }
+            if (--outstanding == 0) {
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+                std::cout << "Assets resident after " << ms << " ms" << std::endl;
+            }
+
+            guard.lock();
+            if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budgetMs) break;
+        }
+    }
+
+    bool IsResident() const { return outstanding == 0; }
+
+    // Call once no decode task can still be running
+    void Unload() {
+        for (auto& d : ready) {
+            if (d.isSound) UnloadWave(d.wave);
+            else UnloadImage(d.image);
+        }
+        ready.clear();
+        for (auto& t : textures) { if (t.id) UnloadTexture(t); t = Texture2D{}; }
+        for (auto& snd : sounds) { if (snd.frameCount) UnloadSound(snd); snd = Sound{}; }
+    }
+
+    // Stable address: the texture becomes usable (id != 0) once uploaded
+    const Texture2D* GetTexture(TextureId id) const { return &textures[id]; }
+    Sound GetSound(SoundId id) const { return sounds[id]; }
+
+    // Decodes every source file into ASSET_PACK_FILE. Needs no window.
+    static bool WritePack() {
+        FILE* out = fopen(ASSET_PACK_FILE, "wb");
+        if (!out) return false;
+        auto put = [out](uint32_t v) { fwrite(&v, 4, 1, out); };
+        auto putSource = [&put](const char* file) {
+            uint64_t time = (uint64_t)GetFileModTime(file);
+            put((uint32_t)GetFileLength(file)); put((uint32_t)time); put((uint32_t)(time >> 32));
+        };
+
+        put(ASSET_PACK_MAGIC);
+        put(ASSET_PACK_VERSION);
+        for (int i = 0; i < TEX_COUNT; ++i) {
+            putSource(TEXTURE_FILES[i]);
+            Image img = LoadImage(TEXTURE_FILES[i]);
+            if (img.data) ImageFormat(&img, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+            uint32_t bytes = img.data ? (uint32_t)GetPixelDataSize(img.width, img.height, img.format) : 0;
+            put((uint32_t)img.width); put((uint32_t)img.height); put((uint32_t)img.format); put(1); put(bytes);
+            if (bytes) fwrite(img.data, 1, bytes, out);
+            UnloadImage(img);
+        }
+        for (int i = 0; i < SND_COUNT; ++i) {
+            putSource(SOUND_FILES[i]);
+            Wave wave = LoadWave(SOUND_FILES[i]);
+            uint32_t bytes = wave.data ? wave.frameCount * wave.channels * (wave.sampleSize / 8) : 0;
+            put(wave.frameCount); put(wave.sampleRate); put(wave.sampleSize); put(wave.channels); put(bytes);
+            if (bytes) fwrite(wave.data, 1, bytes, out);
+            UnloadWave(wave);
+        }
+        bool ok = ferror(out) == 0;
+        fclose(out);
+        return ok;
+    }
+};
+
+// Structure-of-arrays copy of one road's positions, used by the car-following check.
+// Kept index-aligned with the vehicle vector and patched after each vehicle moves,
+// so the result matches checking the live objects in order.
+struct LaneSnapshot {
+    std::vector<float> x;
+    std::vector<float> laneY;     // Target lane, or NO_LANE for vehicles nobody follows
+    std::vector<uint16_t> flags;  // VehicleFlag word of each vehicle
+
+    // Optional copy ordered front to back along the travel direction (see SortByProgress)
+    std::vector<uint32_t> order;  // Vehicle index at each sorted position
+    std::vector<float> sortedX;
+    std::vector<float> sortedLaneY;
+
+    static constexpr float NO_LANE = -1.0e9f;
+
+    void Reserve(size_t vehicles) {
+        x.reserve(vehicles);
+        laneY.reserve(vehicles);
+        flags.reserve(vehicles);
+        order.reserve(vehicles);
+        sortedX.reserve(vehicles);
+        sortedLaneY.reserve(vehicles);
+    }
+
+    void Build(const std::vector<std::unique_ptr<Vehicle>>& vehicles) {
+        x.resize(vehicles.size());
+        laneY.resize(vehicles.size());
+        flags.resize(vehicles.size());
+        for (size_t i = 0; i < vehicles.size(); ++i) Store(i, *vehicles[i]);
+    }
+
+    // Entry for a vehicle kept outside the indexed vector; it is placed after them
+    void Append(const Vehicle& v) {
+        x.push_back(v.GetX());
+        laneY.push_back(v.Has(VF_TOWED) ? NO_LANE : v.GetTargetY());
+        flags.push_back(v.GetFlags());
+    }
+
+    void Store(size_t i, const Vehicle& v) {
+        x[i] = v.GetX();
+        laneY[i] = v.Has(VF_TOWED) ? NO_LANE : v.GetTargetY();
+        flags[i] = v.GetFlags();
+    }
+
+    // Writes the positions in [0, count) that have none of the 'mask' bits to 'out'
+    // and returns how many there are. Branch-free, one pass over the flag words.
+    size_t Without(uint16_t mask, size_t count, uint32_t* out) const {
+        size_t found = 0;
+        for (size_t i = 0; i < count; ++i) {
+            out[found] = (uint32_t)i;
+            found += (flags[i] & mask) == 0;
+        }
+        return found;
+    }
+
+    // Distance to the closest vehicle ahead in the same lane (FLT_MAX if none).
+    // SSE2 checks four vehicles per iteration; both paths give identical results.
+    // The vehicle itself has a gap of 0 and is never counted as its own leader.
+    template <bool DirRight>
+    float LeaderGap(float fromX, float fromLaneY) const {
+#if defined(__SSE2__)
+        const size_t n = x.size();
+        const __m128 from = _mm_set1_ps(fromX);
+        const __m128 lane = _mm_set1_ps(fromLaneY);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        const __m128 tolerance = _mm_set1_ps(5.0f);
+        const __m128 none = _mm_set1_ps(FLT_MAX);
+        __m128 best4 = none;
+        size_t j = 0;
+        for (; j + 4 <= n; j += 4) {
+            __m128 xs = _mm_loadu_ps(&x[j]);
+            __m128 ahead = DirRight ? _mm_sub_ps(xs, from) : _mm_sub_ps(from, xs);
+            __m128 dy = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(&laneY[j]), lane), absMask);
+            __m128 leader = _mm_and_ps(_mm_cmpgt_ps(ahead, _mm_setzero_ps()), _mm_cmplt_ps(dy, tolerance));
+            best4 = _mm_min_ps(best4, _mm_or_ps(_mm_and_ps(leader, ahead), _mm_andnot_ps(leader, none)));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, best4);
+        float best = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+        return LeaderGapScalar<DirRight>(fromX, fromLaneY, j, best);
+#else
+        return LeaderGapScalar<DirRight>(fromX, fromLaneY, 0, FLT_MAX);
+#endif
+    }
+
+    // Orders the snapshot front to back so that a vehicle's leader is among the
+    // entries just before it. A slice of sorted positions then covers one stretch
+    // of road and only reads the few entries in front of it.
+    template <bool DirRight>
+    void SortByProgress() {
+        const size_t n = x.size();
+        order.resize(n);
+        for (size_t i = 0; i < n; ++i) order[i] = (uint32_t)i;
+        std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+            return Heading<DirRight>::Ahead(x[b], x[a]) > 0.0f;
+        });
+        sortedX.resize(n);
+        sortedLaneY.resize(n);
+        for (size_t k = 0; k < n; ++k) {
+            sortedX[k] = x[order[k]];
+            sortedLaneY[k] = laneY[order[k]];
+        }
+    }
+
+    // LeaderGap for the vehicle at sorted position k. Entries before k are at or
+    // ahead of it, nearest last, so the first one in the same lane that is
+    // strictly ahead is the leader.
+    template <bool DirRight>
+    float SortedLeaderGap(size_t k) const {
+        const float fromX = sortedX[k];
+        const float fromLaneY = sortedLaneY[k];
+        for (size_t j = k; j-- > 0;) {
+            float ahead = Heading<DirRight>::Ahead(fromX, sortedX[j]);
+            if (ahead > 0.0f && fabsf(sortedLaneY[j] - fromLaneY) < 5.0f) return ahead;
+        }
+        return FLT_MAX;
+    }
+
+    // Portable kernel for vehicles [begin, n): a select feeding a min, with no
+    // branch in the loop, so the compiler can vectorise it where SSE2 is not available
+    template <bool DirRight>
+    float LeaderGapScalar(float fromX, float fromLaneY, size_t begin = 0, float best = FLT_MAX) const {
+        const size_t n = x.size();
+        const float* xs = x.data();
+        const float* ys = laneY.data();
+        for (size_t j = begin; j < n; ++j) {
+            float ahead = Heading<DirRight>::Ahead(fromX, xs[j]);
+            bool leader = (ahead > 0.0f) & (fabsf(ys[j] - fromLaneY) < 5.0f);
+            best = std::min(best, leader ? ahead : FLT_MAX);
+        }
+        return best;
+    }
+};
+
+// Parent/child attachment (tow truck -> towed car).
+// Links are kept in attach order, so a parent is always placed before its children.
+struct TowLink {
+    Vehicle* parent;
+    Vehicle* child;
+    float offsetX;  // Child position relative to the parent
+};
+
+struct Accident {
+    bool active;
+    bool pending; // Waiting for collision
+    float x;
+    float y;
+    Vehicle* car1; // Front
+    Vehicle* car2; // Rear (Aggressor)
+};
+
+// Discrete events on the simulation clock
+// Light changes and car arrivals belong to the road processes (RoadProcess)
+enum SimEventType {
+    EVT_WAKE           // A service vehicle's timed state ends
+};
+
+struct SimEvent {
+    double time;
+    SimEventType type;
+    uint64_t seq;  // Scheduling order, breaks ties so runs stay reproducible
+
+    bool operator>(const SimEvent& o) const { return time != o.time ? time > o.time : seq > o.seq; }
+};
+
+class EventQueue {
+private:
+    std::vector<SimEvent> heap;  // Min-heap
+    uint64_t nextSeq = 0;
+public:
+    void Reserve(size_t events) { heap.reserve(events); }
+
+    void Schedule(double time, SimEventType type) {
+        heap.push_back({ time, type, nextSeq++ });
+        std::push_heap(heap.begin(), heap.end(), std::greater<SimEvent>());
+    }
+
+    // Next event due at or before 'now', earliest first
+    bool PopDue(double now, SimEvent& out) {
+        if (heap.empty() || heap.front().time > now) return false;
+        std::pop_heap(heap.begin(), heap.end(), std::greater<SimEvent>());
+        out = heap.back();
+        heap.pop_back();
+        return true;
+    }
+};
+
+// A car on the off-screen entry link. It only exists as a queue entry
+// until it reaches the spawn point and there is room to place it.
+struct QueuedVehicle {
+    double exitTime;  // Free-flow arrival at the spawn point
+    float speed;
+    Color color;
+    TextureId image;
+    double entryTime;  // When it joined the link; carried over to the promoted car
+};
+
+// xorshift64, inclusive range like GetRandomValue. 'state' must not be 0.
+static int XorshiftRange(uint64_t& state, int min, int max) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return min + (int)(state % (uint64_t)(max - min + 1));
+}
+
+enum RoadEventType {
+    ROAD_LIGHT,      // Timed light change
+    ROAD_SPAWN,      // A car joins the entry link
+    ROAD_SET_PHASE   // Signal-control input
+};
+
+struct RoadEvent {
+    double time;
+    RoadEventType type;
+    bool input;    // Sent from outside; comes after the road's own events at the same time
+    uint64_t seq;  // Own events: scheduling order. Inputs: arrival order.
+    bool red;      // ROAD_SET_PHASE
+
+    bool operator>(const RoadEvent& o) const {
+        if (time != o.time) return time > o.time;
+        if (input != o.input) return input;
+        return seq > o.seq;
+    }
+};
+
+struct RoadArrival {
+    int lane;
+    QueuedVehicle car;
+};
+
+// Everything an event can change, saved before each one
+struct RoadState {
+    TrafficLight light;
+    double changedAt;   // Sim time of the last light change
+    uint64_t rng;
+    uint64_t nextSeq;   // Own events scheduled so far
+    size_t arrivals;    // Cars produced so far, committed or not
+};
+
+// One road's discrete events (light changes, entry-link arrivals, signal inputs)
+// as a Time Warp logical process. Advance runs it ahead of the frame clock
+// without waiting for inputs; the state is saved before every event. An input
+// stamped earlier than events already run (a straggler) rolls the process back
+// to the saved state before the first of them; they run again afterwards.
+// Events a rolled-back event scheduled are dropped rather than chased with
+// anti-messages: they are all local and carry a sequence number at or above the
+// restored one. Nothing leaves the process before Commit, so the vehicles only
+// ever see committed lights and cars, and the outcome does not depend on how
+// far it ran ahead.
+class RoadProcess {
+private:
+    struct Processed {
+        RoadEvent event;
+        RoadState before;
+    };
+
+    RoadState state;
+    RoadState committed;               // State at the last commit time
+    std::vector<RoadEvent> pending;    // Min-heap
+    std::vector<Processed> processed;  // Not yet committed, in execution order
+    std::vector<RoadArrival> arrivals; // Not yet committed; arrivals[0] is car number arrivalBase
+    size_t arrivalBase = 0;
+    double advancedTo = 0.0;           // Every event up to here has run
+    uint64_t inputSeq = 0;
+    bool externalSignals = false;
+    size_t rolledBack = 0;             // Events undone so far
+
+    int Random(int min, int max) { return XorshiftRange(state.rng, min, max); }
+
+    void Push(const RoadEvent& ev) {
+        pending.push_back(ev);
+        std::push_heap(pending.begin(), pending.end(), std::greater<RoadEvent>());
+    }
+
+    void Schedule(double time, RoadEventType type) { Push({ time, type, false, state.nextSeq++, false }); }
+
+    void Execute(const RoadEvent& ev) {
+        processed.push_back({ ev, state });
+        switch (ev.type) {
+            case ROAD_LIGHT:
+                if (externalSignals) break;
+                state.light.Toggle();
+                state.changedAt = ev.time;
+                Schedule(ev.time + state.light.GetCycleTime(), ROAD_LIGHT);
+                break;
+            case ROAD_SPAWN: {
+                int lane = Random(0, 2);
+                float speed = 2.0f + Random(0, 5) / 10.0f;
+                Color c = { (unsigned char)Random(80, 255), (unsigned char)Random(80, 255), (unsigned char)Random(80, 255), 255 };
+                double travel = ENTRY_LINK_LENGTH / (speed * TARGET_FPS);
+                TextureId image = (TextureId)(TEX_CAR + Random(0, CAR_TEXTURE_COUNT - 1));
+                arrivals.push_back({ lane, { ev.time + travel, speed, c, image, ev.time } });
+                state.arrivals++;
+                // ADJUSTED TRAFFIC: Spawn every 2.0s - 3.5s
+                Schedule(ev.time + Random(20, 35) / 10.0, ROAD_SPAWN);
+                break;
+            }
+            case ROAD_SET_PHASE:
+                if (state.light.IsRed() == ev.red) break;
+                state.light.Toggle();
+                state.changedAt = ev.time;
+                break;
+        }
+    }
+
+    // Undoes every event later than 'time'
+    void Rollback(double time) {
+        size_t keep = processed.size();
+        while (keep > 0 && processed[keep - 1].event.time > time) --keep;
+        advancedTo = std::min(advancedTo, time);
+        if (keep == processed.size()) return;
+
+        state = processed[keep].before;
+        auto orphan = [this](const RoadEvent& ev) { return !ev.input && ev.seq >= state.nextSeq; };
+        pending.erase(std::remove_if(pending.begin(), pending.end(), orphan), pending.end());
+        for (size_t i = keep; i < processed.size(); ++i)
+            if (!orphan(processed[i].event)) pending.push_back(processed[i].event);
+        std::make_heap(pending.begin(), pending.end(), std::greater<RoadEvent>());
+        rolledBack += processed.size() - keep;
+        processed.erase(processed.begin() + keep, processed.end());
+        arrivals.erase(arrivals.begin() + (state.arrivals - arrivalBase), arrivals.end());
+    }
+
+public:
+    explicit RoadProcess(const TrafficLight& light) : state({ light, 0.0, 1, 0, 0 }), committed(state) {
+        Schedule(light.GetCycleTime(), ROAD_LIGHT);
+        Schedule(2.0, ROAD_SPAWN);
+    }
+
+    void Reserve(size_t events) {
+        pending.reserve(events);
+        processed.reserve(events);
+        arrivals.reserve(events);
+    }
+
+    // Before the first Advance only
+    void Seed(uint64_t seed) { state.rng = committed.rng = seed ? seed : 1; }
+    void TakeSignalControl() { externalSignals = true; }
+
+    // Sets the light at 'time', which must not be before the last commit
+    void SetPhase(double time, bool red) {
+        Rollback(time);
+        Push({ time, ROAD_SET_PHASE, true, inputSeq++, red });
+    }
+
+    // Runs every event up to 'horizon'
+    void Advance(double horizon) {
+        while (!pending.empty() && pending.front().time <= horizon) {
+            std::pop_heap(pending.begin(), pending.end(), std::greater<RoadEvent>());
+            RoadEvent ev = pending.back();
+            pending.pop_back();
+            Execute(ev);
+        }
+        advancedTo = std::max(advancedTo, horizon);
+    }
+
+    // Fixes everything up to 'gvt' (no input will be stamped earlier): calls
+    // deliver(const RoadArrival&) for the cars that joined the link by then and
+    // frees their saved states. Needs Advance(gvt) first.
+    template <typename Fn>
+    void Commit(double gvt, Fn deliver) {
+        size_t done = 0;
+        while (done < processed.size() && processed[done].event.time <= gvt) ++done;
+        processed.erase(processed.begin(), processed.begin() + done);
+
+        size_t out = 0;
+        while (out < arrivals.size() && arrivals[out].car.entryTime <= gvt) deliver(arrivals[out++]);
+        arrivals.erase(arrivals.begin(), arrivals.begin() + out);
+        arrivalBase += out;
+
+        committed = processed.empty() ? state : processed.front().before;
+    }
+
+    const RoadState& Committed() const { return committed; }
+    double AdvancedTo() const { return advancedTo; }
+    size_t RolledBack() const { return rolledBack; }
+};
+
+// Renders frames into offscreen targets and encodes them on the task pool.
+// The two targets alternate: a frame is read back while the next one is being
+// drawn, so the readback does not wait on the draw calls just issued.
+class FrameRecorder {
+private:
+    RenderTexture2D targets[2] = {};
+    std::string prefix;
+    long frame = 0;                // Frames drawn since Start
+    long tick = 0;                 // Frames offered since Start
+    int every = 1;                 // Keep one frame in 'every'
+    std::atomic<int> inFlight{0};  // Frames read back but not yet written
+    bool active = false;
+
+    void Encode(long index, TaskPool& pool) {
+        while (inFlight >= CAPTURE_MAX_IN_FLIGHT) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        Image image = LoadImageFromTexture(targets[index % 2].texture);
+        std::string path = prefix + TextFormat("%05ld", index) + CAPTURE_FORMAT;
+        ++inFlight;
+        pool.Submit(PRIORITY_IO, [this, image, path]() mutable {
+            ImageFlipVertical(&image);  // Render targets are stored bottom-up
+            ExportImage(image, path.c_str());
+            UnloadImage(image);
+            --inFlight;
+        });
+    }
+
+public:
+    bool IsActive() const { return active; }
+    void SetEvery(int n) { every = n; }
+    bool Due() { return tick++ % every == 0; }
+
+    void Start(const char* filePrefix) {
+        for (auto& t : targets) t = LoadRenderTexture(SCREEN_WIDTH, SCREEN_HEIGHT);
+        prefix = filePrefix;
+        frame = tick = 0;
+        active = true;
+    }
+
+    void BeginFrame() { BeginTextureMode(targets[frame % 2]); }
+
+    // Queues the previous frame, whose target is no longer being drawn to
+    void EndFrame(TaskPool& pool) {
+        EndTextureMode();
+        if (frame > 0) Encode(frame - 1, pool);
+        ++frame;
+    }
+
+    // Writes the last frame and waits for every encode to finish
+    void Stop(TaskPool& pool) {
+        if (!active) return;
+        if (frame > 0) Encode(frame - 1, pool);
+        while (inFlight > 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        for (auto& t : targets) UnloadRenderTexture(t);
+        active = false;
+        std::cout << "Recorded " << frame << " frames to " << prefix << "*" << CAPTURE_FORMAT << std::endl;
+    }
+};
+
+// Ways to shed frame time, cheapest loss first
+enum DegradeLevel {
+    DEGRADE_NONE,
+    DEGRADE_HUD,          // Skip the HUD text
+    DEGRADE_LOD,          // Every lane chunk one LOD tier coarser
+    DEGRADE_DRAW_RATE,    // Redraw every other frame, show the held frame in between
+    DEGRADE_RECORD_RATE,  // Record every other frame
+    DEGRADE_COUNT
+};
+
+constexpr const char* DEGRADE_NAMES[DEGRADE_COUNT] = { "full detail", "no HUD", "coarser LOD", "half draw rate", "half recording rate" };
+
+// Holds the frame time under FRAME_BUDGET_MS by stepping through DegradeLevel.
+// It only changes how frames are presented: the simulation still gets one
+// Update per frame with the real frame delta.
+class FrameGovernor {
+private:
+    DegradeLevel level = DEGRADE_NONE;
+    double updateMs = 0.0;   // Smoothed per-frame phase costs; skipped phases count as 0
+    double drawMs = 0.0;
+    double captureMs = 0.0;
+    int overFrames = 0;      // Consecutive frames over budget
+    int underFrames = 0;     // Consecutive frames with room to spare
+    long frame = 0;
+
+    static void Smooth(double& average, double sample) { average += 0.1 * (sample - average); }
+
+    void Change(DegradeLevel to, double cost) {
+        std::cout << "Frame governor: " << cost << " ms/frame (update " << updateMs << ", draw " << drawMs
+                  << ", capture " << captureMs << ") -> " << DEGRADE_NAMES[to] << std::endl;
+        level = to;
+        overFrames = underFrames = 0;
+    }
+
+public:
+    void Record(double update, double draw, double capture) {
+        ++frame;
+        Smooth(updateMs, update);
+        Smooth(drawMs, draw);
+        Smooth(captureMs, capture);
+
+        double cost = updateMs + drawMs + captureMs;
+        if (cost > FRAME_BUDGET_MS) {
+            underFrames = 0;
+            if (++overFrames >= GOVERNOR_DEGRADE_FRAMES && level + 1 < DEGRADE_COUNT) Change((DegradeLevel)(level + 1), cost);
+        } else if (cost < FRAME_BUDGET_MS * GOVERNOR_RECOVER_RATIO) {
+            overFrames = 0;
+            if (++underFrames >= GOVERNOR_RECOVER_FRAMES && level > DEGRADE_NONE) Change((DegradeLevel)(level - 1), cost);
+        } else {
+            overFrames = underFrames = 0;
+        }
+    }
+
+    bool ShowHud() const { return level < DEGRADE_HUD; }
+    int LodBias() const { return level >= DEGRADE_LOD ? 1 : 0; }
+    bool HoldsFrames() const { return level >= DEGRADE_DRAW_RATE; }
+    bool DrawThisFrame() const { return !HoldsFrames() || frame % 2 == 0; }
+    int RecordEvery() const { return level >= DEGRADE_RECORD_RATE ? 2 : 1; }
+};
+
+// Time-space diagram: time runs left to right, one column per simulation step,
+// and each lane is a horizontal band with position increasing upwards in the
+// direction of travel. Stopped vehicles are red, so queues and the shockwaves
+// moving back through them show as red streaks. The texture is a ring of columns:
+// each step uploads only its own column.
+class TimeSpaceDiagram {
+private:
+    static constexpr int LANES = 6;
+    static constexpr int HEIGHT = LANES * TSD_BAND_HEIGHT;
+
+    Texture2D texture = {};
+    Color column[HEIGHT];
+    int head = 0;  // Column the next step writes
+    bool visible = false;
+
+public:
+    bool IsVisible() const { return visible; }
+
+    void Toggle() {
+        visible = !visible;
+        if (!visible) return;
+        if (texture.id == 0) {
+            Image blank = GenImageColor(TSD_COLUMNS, HEIGHT, TSD_BACKGROUND);
+            texture = LoadTextureFromImage(blank);
+            UnloadImage(blank);
+        } else {
+            // Start from an empty window rather than show a gap in time
+            for (auto& c : column) c = TSD_BACKGROUND;
+            for (int i = 0; i < TSD_COLUMNS; ++i) UpdateTextureRec(texture, { (float)i, 0, 1, (float)HEIGHT }, column);
+        }
+        head = 0;
+    }
+
+    void BeginColumn() {
+        for (int row = 0; row < HEIGHT; ++row) column[row] = row % TSD_BAND_HEIGHT == 0 ? GRAY : TSD_BACKGROUND;
+    }
+
+    void Plot(int lane, float x, bool dirRight, bool stopped) {
+        float along = (x - LOD_WORLD_MIN_X) / (SCREEN_WIDTH + 400.0f - LOD_WORLD_MIN_X);
+        if (along < 0.0f || along > 1.0f) return;
+        if (!dirRight) along = 1.0f - along;
+        int row = (lane + 1) * TSD_BAND_HEIGHT - 1 - (int)(along * (TSD_BAND_HEIGHT - 2));
+        column[row] = stopped ? RED : BLACK;
+    }
+
+    void EndColumn() {
+        UpdateTextureRec(texture, { (float)head, 0, 1, (float)HEIGHT }, column);
+        head = (head + 1) % TSD_COLUMNS;
+    }
+
+    // Oldest column on the left: the ring is drawn in two pieces
+    void Draw(int left, int top) const {
+        DrawTextureRec(texture, { (float)head, 0, (float)(TSD_COLUMNS - head), (float)HEIGHT }, { (float)left, (float)top }, WHITE);
+        DrawTextureRec(texture, { 0, 0, (float)head, (float)HEIGHT }, { (float)(left + TSD_COLUMNS - head), (float)top }, WHITE);
+        DrawRectangleLines(left - 1, top - 1, TSD_COLUMNS + 2, HEIGHT + 2, WHITE);
+        DrawText("time ->", left, top + HEIGHT + 4, 10, WHITE);
+    }
+
+    void Unload() {
+        if (texture.id) UnloadTexture(texture);
+        texture = Texture2D{};
+    }
+};
+
+// Rolling density and mean speed per lane segment. The counts are kept up to
+// date where vehicles move: Move only touches them when a vehicle crosses into
+// another bin or its speed changes, and Remove takes a vehicle out when it is
+// erased. Step folds the current counts into the smoothed values.
+class LaneHeatmap {
+private:
+    static constexpr int LANES = 6;
+    static constexpr int BINS = LANES * HEAT_BINS;
+
+    int count[BINS] = {};
+    float speedSum[BINS] = {};
+    float density[BINS] = {};    // Smoothed vehicle count
+    float meanSpeed[BINS] = {};  // Smoothed mean speed of the vehicles present
+    bool visible = false;
+
+public:
+    bool IsVisible() const { return visible; }
+    void SetVisible(bool on) { visible = on; }
+
+    // Bin for a vehicle in 'lane' at x, or -1 outside the mapped stretch of road
+    static int Bin(int lane, float x) {
+        int segment = (int)floorf((x - LOD_WORLD_MIN_X) / HEAT_BIN_WIDTH);
+        return segment >= 0 && segment < HEAT_BINS ? lane * HEAT_BINS + segment : -1;
+    }
+
+    // Counts v in 'bin' (-1 for none) at 'speed' instead of where it was counted so far
+    void Move(Vehicle& v, int bin, float speed) {
+        int old = v.GetHeatBin();
+        if (old == bin && v.GetHeatSpeed() == speed) return;
+        if (old >= 0) {
+            // Reset when empty so rounding never accumulates
+            speedSum[old] = --count[old] ? speedSum[old] - v.GetHeatSpeed() : 0.0f;
+        }
+        if (bin >= 0) {
+            ++count[bin];
+            speedSum[bin] += speed;
+        }
+        v.SetHeat(bin, speed);
+    }
+
+    void Remove(Vehicle& v) { Move(v, -1, 0.0f); }
+
+    // Once per step while shown: roll the smoothed values towards the current counts
+    void Step() {
+        for (int i = 0; i < BINS; ++i) {
+            density[i] += HEAT_SMOOTHING * (count[i] - density[i]);
+            if (count[i]) meanSpeed[i] += HEAT_SMOOTHING * (speedSum[i] / count[i] - meanSpeed[i]);
+        }
+    }
+
+    // Forgets the smoothed values, so a reshown overlay starts from the current traffic
+    void ClearSmoothed() {
+        std::fill(density, density + BINS, 0.0f);
+        std::fill(meanSpeed, meanSpeed + BINS, 0.0f);
+    }
+
+    // World space, one rectangle per occupied bin: green at free-flow speed, red when stopped
+    void Draw() const {
+        const float capacity = HEAT_BIN_WIDTH / (VEHICLE_WIDTH + SAFE_DISTANCE);
+        for (int i = 0; i < BINS; ++i) {
+            if (density[i] < 0.05f) continue;
+            int lane = i / HEAT_BINS;
+            float flow = std::min(meanSpeed[i] / HEAT_FREE_SPEED, 1.0f);
+            float load = std::min(density[i] / capacity, 1.0f);
+            Color shade = { (unsigned char)(255 * std::min(2.0f - 2.0f * flow, 1.0f)),
+                            (unsigned char)(255 * std::min(2.0f * flow, 1.0f)), 0,
+                            (unsigned char)(60 + 160 * load) };
+            float laneTop = (float)(lane < 3 ? ROAD_Y_TOP : ROAD_Y_BOTTOM) + (lane % 3) * LANE_HEIGHT;
+            DrawRectangleRec({ LOD_WORLD_MIN_X + (i % HEAT_BINS) * HEAT_BIN_WIDTH, laneTop, HEAT_BIN_WIDTH, (float)LANE_HEIGHT }, shade);
+        }
+    }
+};
+
+// Metrics sampled once per simulation step
+enum MetricId {
+    METRIC_FLOW,      // Vehicles leaving the road during the step
+    METRIC_SPEED,     // Mean speed of the vehicles on the road, stopped ones included
+    METRIC_QUEUE,     // Vehicles standing still (not crashed or towed)
+    METRIC_RESPONSE,  // Seconds from an ambulance call to its arrival; sampled on arrival only
+    METRIC_STEP_MS,   // Wall time of Simulation::Update
+    METRIC_TRAVEL,    // Seconds from entering the entry link to leaving the road; sampled on exits only
+    METRIC_UPDATE_ALLOCS,  // Heap allocations during the previous frame's update
+    METRIC_DRAW_ALLOCS,    // Heap allocations during the previous frame's draw
+    METRIC_COUNT
+};
+
+constexpr const char* METRIC_NAMES[METRIC_COUNT] = { "flow", "speed", "queue", "response_s", "step_ms", "travel_s",
+                                                     "update_allocs", "draw_allocs" };
+
+enum MetricResolution { RES_SECOND, RES_MINUTE, RES_HOUR, RES_COUNT };
+
+constexpr double METRIC_RES_SECONDS[RES_COUNT] = { 1.0, 60.0, 3600.0 };
+constexpr const char* METRIC_RES_NAMES[RES_COUNT] = { "1s", "1min", "1h" };
+constexpr size_t METRIC_RES_KEPT[RES_COUNT] = { 3600, 1440, 720 };  // 1 hour, 1 day, 30 days
+constexpr double METRIC_RAW_SECONDS = 60.0;                         // Raw samples kept, in simulated seconds
+constexpr size_t METRIC_RAW_RESERVED = 60 * TARGET_FPS;             // One sample per step at the target rate
+
+struct MetricSample {
+    double time;
+    float value;
+};
+
+struct MetricRollup {
+    double start = 0.0;  // Bucket start on the simulation clock
+    float min = 0.0f;
+    float max = 0.0f;
+    double sum = 0.0;
+    uint32_t count = 0;
+
+    static MetricRollup Single(double time, float value) {
+        MetricRollup one;
+        one.start = time;
+        one.min = one.max = value;
+        one.sum = value;
+        one.count = 1;
+        return one;
+    }
+
+    float Mean() const { return count ? (float)(sum / count) : 0.0f; }
+
+    void Merge(const MetricRollup& o) {
+        min = count ? std::min(min, o.min) : o.min;
+        max = count ? std::max(max, o.max) : o.max;
+        sum += o.sum;
+        count += o.count;
+    }
+};
+
+// One metric: raw samples for the last METRIC_RAW_SECONDS of simulated time
+// plus min/max/mean buckets at each resolution. Appending is amortised O(1):
+// a sample goes into the open one-second bucket, and a bucket that closes is
+// merged into the next coarser one. The raw ring only grows while samples
+// come in faster than it has held so far.
+class MetricSeries {
+private:
+    struct Tier {
+        Ring<MetricRollup> closed;
+        MetricRollup open;  // Still filling; count 0 when there is none
+    };
+
+    Ring<MetricSample> raw{ METRIC_RAW_RESERVED };
+    Tier tiers[RES_COUNT] = { { Ring<MetricRollup>(METRIC_RES_KEPT[RES_SECOND]), {} },
+                              { Ring<MetricRollup>(METRIC_RES_KEPT[RES_MINUTE]), {} },
+                              { Ring<MetricRollup>(METRIC_RES_KEPT[RES_HOUR]), {} } };
+
+    void Feed(int res, const MetricRollup& part) {
+        Tier& tier = tiers[res];
+        double start = floor(part.start / METRIC_RES_SECONDS[res]) * METRIC_RES_SECONDS[res];
+        if (tier.open.count && start != tier.open.start) {
+            tier.closed.Push(tier.open);
+            if (res + 1 < RES_COUNT) Feed(res + 1, tier.open);
+            tier.open.count = 0;
+        }
+        if (!tier.open.count) {
+            tier.open = MetricRollup();
+            tier.open.start = start;
+        }
+        tier.open.Merge(part);
+    }
+
+public:
+    void Append(double time, float value) {
+        while (raw.Size() && raw[0].time < time - METRIC_RAW_SECONDS) raw.PopFront();
+        raw.PushGrow({ time, value });
+        Feed(RES_SECOND, MetricRollup::Single(time, value));
+    }
+
+    // Raw samples at or after 'from', oldest first
+    template <typename F>
+    void ForEachRaw(double from, F visit) const {
+        for (size_t i = raw.LowerBound(from, [](const MetricSample& s) { return s.time; }); i < raw.Size(); ++i) visit(raw[i]);
+    }
+
+    // Buckets starting at or after 'from', oldest first, ending with the one still open
+    template <typename F>
+    void ForEach(MetricResolution res, double from, F visit) const {
+        const Tier& tier = tiers[res];
+        for (size_t i = tier.closed.LowerBound(from, [](const MetricRollup& r) { return r.start; }); i < tier.closed.Size(); ++i)
+            visit(tier.closed[i]);
+        if (tier.open.count && tier.open.start >= from) visit(tier.open);
+    }
+};
+
+struct MetricRow {
+    MetricId metric;
+    const char* resolution;  // METRIC_RES_NAMES, or "raw" for a single sample
+    MetricRollup bucket;
+};
+
+class MetricStore {
+private:
+    MetricSeries series[METRIC_COUNT];
+
+public:
+    void Append(MetricId id, double time, float value) { series[id].Append(time, value); }
+    const MetricSeries& Get(MetricId id) const { return series[id]; }
+
+    // Copy of every bucket of every metric at every resolution, then the raw samples
+    std::vector<MetricRow> Rows() const {
+        std::vector<MetricRow> rows;
+        for (int m = 0; m < METRIC_COUNT; ++m) {
+            for (int r = 0; r < RES_COUNT; ++r) {
+                series[m].ForEach((MetricResolution)r, -DBL_MAX, [&](const MetricRollup& b) {
+                    rows.push_back({ (MetricId)m, METRIC_RES_NAMES[r], b });
+                });
+            }
+            series[m].ForEachRaw(-DBL_MAX, [&](const MetricSample& s) {
+                rows.push_back({ (MetricId)m, "raw", MetricRollup::Single(s.time, s.value) });
+            });
+        }
+        return rows;
+    }
+
+    // One CSV line per row; needs no store, so it can run on any thread
+    static bool WriteCsv(const char* path, const std::vector<MetricRow>& rows) {
+        FILE* out = fopen(path, "w");
+        if (!out) return false;
+        fprintf(out, "metric,resolution,start,min,max,mean,count\n");
+        for (const MetricRow& row : rows) {
+            const MetricRollup& b = row.bucket;
+            fprintf(out, "%s,%s,%.3f,%g,%g,%g,%u\n", METRIC_NAMES[row.metric], row.resolution,
+                    b.start, b.min, b.max, b.Mean(), b.count);
         }
+        bool ok = ferror(out) == 0;
+        fclose(out);
+        return ok;
     }
-};
 
-struct Accident {
-    bool active;
-    bool pending; // Waiting for collision
-    float x;
-    float y;
-    Vehicle* car1; // Front
-    Vehicle* car2; // Rear (Aggressor)
+    // One sparkline per metric over the last minute of one-second buckets:
+    // the min-max range as a band and the mean as a line
+    void Draw(int left, int top, double now) const {
+        const int width = 300, rowHeight = 44;
+        DrawRectangle(left - 6, top - 6, width + 12, METRIC_COUNT * rowHeight + 8, Fade(BLACK, 0.6f));
+        for (int m = 0; m < METRIC_COUNT; ++m) {
+            int rowTop = top + m * rowHeight;
+            float lo = FLT_MAX, hi = -FLT_MAX, last = 0.0f;
+            series[m].ForEach(RES_SECOND, now - 60.0, [&](const MetricRollup& b) {
+                lo = std::min(lo, b.min);
+                hi = std::max(hi, b.max);
+                last = b.Mean();
+            });
+            DrawText(TextFormat("%s  %.2f", METRIC_NAMES[m], last), left, rowTop, 10, WHITE);
+            if (lo > hi) continue;
+            float span = hi > lo ? hi - lo : 1.0f;
+            auto yOf = [&](float v) { return rowTop + rowHeight - 4 - (v - lo) / span * (rowHeight - 18); };
+            auto xOf = [&](double t) { return left + (float)((t - (now - 60.0)) / 60.0) * width; };
+            Vector2 prev = { -1.0f, 0.0f };
+            series[m].ForEach(RES_SECOND, now - 60.0, [&](const MetricRollup& b) {
+                float x = xOf(b.start);
+                DrawLineV({ x, yOf(b.min) }, { x, yOf(b.max) }, Fade(SKYBLUE, 0.5f));
+                Vector2 at = { x, yOf(b.Mean()) };
+                if (prev.x >= 0.0f) DrawLineV(prev, at, YELLOW);
+                prev = at;
+            });
+        }
+    }
 };
 
 class Simulation {
 private:
-    std::vector<std::unique_ptr<Vehicle>> vehiclesTop;
-    std::vector<std::unique_ptr<Vehicle>> vehiclesBottom;
+    LaneHeatmap heat;
+    std::vector<std::unique_ptr<Vehicle>> vehiclesTop;     // Cars only
+    std::vector<std::unique_ptr<Vehicle>> vehiclesBottom;  // Cars only
+    std::vector<std::unique_ptr<Vehicle>> spareCars;       // Erased cars, reused by TakeCar
+    // Service vehicles (bottom road) are few and run their own state machines,
+    // so they are kept apart and the car loops stay uniform
+    std::vector<std::unique_ptr<Ambulance>> ambulances;
+    std::vector<std::unique_ptr<Depannage>> towTrucks;
     TrafficLight lightTop;
     TrafficLight lightBottom;
     Road road;
-    Texture2D hospitalTexture{};
+    AssetCache assets;
     float laneYTop[3];
     float laneYBottom[3];
-    float carSpawnTimerTop, carSpawnTimerBottom;
-    const char* carImages[5] = { "car.png", "cars.png", "car2.png", "car3.png", "car4.png" };
-    Sound siren{};
+    double simTime = 0.0;
+    EventQueue events;     // Service-vehicle wake-ups
+    RoadProcess roadTop;   // Light and arrivals of each road, run ahead speculatively
+    RoadProcess roadBottom;
+    Ring<QueuedVehicle> entryTop[3];     // Off-screen link queues, one per lane
+    Ring<QueuedVehicle> entryBottom[3];
+    size_t carsEntered = 0;  // Cars created on an entry link so far
+    size_t carsExited = 0;   // Cars removed from the road so far
 
     bool ambulanceActive = false;
     float screenAlertTimer = 0.0f;
@@ -324,11 +1910,230 @@ private:
     
     Accident currentAccident;
 
+    LaneSnapshot snapTop;
+    LaneSnapshot snapBottom;
+    StepArena stepArena;            // Scratch memory for the current Update, reset at its end
+    std::unique_ptr<TaskPool> pool; // Created on first parallel use
+    TaskPool* sharedPool = nullptr; // Owner's pool, used instead when set
+    Camera2D camera = { { 0.0f, 0.0f }, { 0.0f, 0.0f }, 0.0f, 1.0f };
+    FrameRecorder recorder;
+    TimeSpaceDiagram diagram;
+    std::unique_ptr<MetricStore> metrics;  // Created by Init; headless instances record none
+    bool chartsVisible = false;
+    double responseStart = -1.0;  // Sim time of the unanswered ambulance call, or -1
+    uint64_t rng = 0x9E3779B97F4A7C15ull;  // Per instance, so simulations can run on different threads
+    bool randomIncidents = true;   // Random accidents; nothing tows them away without a user
+    double topChangedAt = 0.0;     // Sim time of the last light change
+    double bottomChangedAt = 0.0;
+
+    int Random(int min, int max) { return XorshiftRange(rng, min, max); }
+    bool hudVisible = true;
+    int lodBias = 0;  // Extra LOD tiers of coarsening asked for by the frame governor
+
+    TaskPool& Pool() {
+        if (sharedPool) return *sharedPool;
+        if (!pool) pool = std::make_unique<TaskPool>();
+        return *pool;
+    }
+
+    std::vector<TowLink> towLinks;
+    Depannage* towTruck = nullptr;
+
+    // Top road in two phases: every car decides from the start-of-step snapshot,
+    // then all cars move in order. Decisions only read the snapshot and write their
+    // own slot, so long roads are split into chunks across threads and the result
+    // does not depend on the thread count.
+    void UpdateTopRoad() {
+        const size_t n = vehiclesTop.size();
+        snapTop.Build(vehiclesTop);
+        snapTop.SortByProgress<true>();
+        ArenaVector<uint8_t> stopTop(n, 0, ArenaAllocator<uint8_t>(&stepArena));
+
+        // Slices are runs of sorted positions, i.e. stretches of road
+        auto decide = [this, &stopTop](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                uint32_t i = snapTop.order[k];
+                stopTop[i] = MustStop<true>(*vehiclesTop[i], lightTop, true,
+                                            [this, k] { return snapTop.SortedLeaderGap<true>(k); });
+            }
+        };
+
+        if (n < PARALLEL_MIN_VEHICLES) {
+            decide(0, n);
+        } else {
+            TaskPool& tasks = Pool();
+            tasks.ParallelFor(n, std::min(tasks.WorkerCount() + 1, n / (PARALLEL_MIN_VEHICLES / 4)), decide);
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            vehiclesTop[i]->SetForcedStop(stopTop[i] != 0);
+            vehiclesTop[i]->UpdateDir<true>(stopTop[i] != 0);
+            TrackHeat(*vehiclesTop[i], true);
+        }
+    }
+
+    void HandleEvent(const SimEvent& ev) {
+        switch (ev.type) {
+            case EVT_WAKE:
+                // Only vehicles whose deadline has passed change state
+                for (auto& a : ambulances) if (a->Wake(ev.time)) ScheduleWake(*a);
+                for (auto& t : towTrucks) if (t->Wake(ev.time)) ScheduleWake(*t);
+                break;
+        }
+    }
+
+    // Call after a service vehicle changed state: a timed state gets its wake event
+    void ScheduleWake(const Vehicle& v) {
+        if (v.GetWakeTime() > 0.0) events.Schedule(v.GetWakeTime(), EVT_WAKE);
+    }
+
+    // Both road processes run ahead in one batch on the pool once either gets
+    // within half the lookahead of the frame clock (or was rolled back behind it).
+    // simTime is the GVT: signal inputs are never stamped earlier, so everything
+    // up to it is committed and becomes visible to the vehicles.
+    void AdvanceRoads() {
+        double horizon = simTime + ROAD_LOOKAHEAD;
+        if (roadTop.AdvancedTo() < simTime + ROAD_LOOKAHEAD / 2 || roadBottom.AdvancedTo() < simTime + ROAD_LOOKAHEAD / 2) {
+            Pool().ParallelFor(2, 2, [this, horizon](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) (i == 0 ? roadTop : roadBottom).Advance(horizon);
+            });
+        }
+
+        roadTop.Commit(simTime, [this](const RoadArrival& a) {
+            entryTop[a.lane].PushGrow(a.car);
+            carsEntered++;
+        });
+        roadBottom.Commit(simTime, [this](const RoadArrival& a) {
+            entryBottom[a.lane].PushGrow(a.car);
+            carsEntered++;
+        });
+        lightTop = roadTop.Committed().light;
+        topChangedAt = roadTop.Committed().changedAt;
+        lightBottom = roadBottom.Committed().light;
+        bottomChangedAt = roadBottom.Committed().changedAt;
+    }
+
+    // Promotes queued cars to full vehicles once they reach the spawn point.
+    // A car whose spot is still taken waits (and holds up the cars behind it),
+    // so no car is lost or overtaken at the boundary. Service vehicles, which all
+    // drive on the bottom road, take up spots there too.
+    template <bool DirRight>
+    void ReleaseEntries(Ring<QueuedVehicle> (&queues)[3], const float (&laneY)[3],
+                        std::vector<std::unique_ptr<Vehicle>>& vehicles, float spawnX) {
+        for (int lane = 0; lane < 3; lane++) {
+            auto& queue = queues[lane];
+            while (!queue.Empty() && queue.Front().exitTime <= simTime) {
+                bool blocked = false;
+                auto check = [&](const Vehicle& v) {
+                    if (fabs(v.GetTargetY() - laneY[lane]) < 5.0f &&
+                        fabs(v.GetX() - spawnX) < VEHICLE_WIDTH + SAFE_DISTANCE) blocked = true;
+                };
+                for (auto& v : vehicles) {
+                    check(*v);
+                    if (blocked) break;
+                }
+                if (!DirRight && !blocked) ForEachService(check);
+                if (blocked) break;
+
+                const QueuedVehicle& q = queue.Front();
+                vehicles.push_back(TakeCar(spawnX, laneY[lane], q.speed, q.color, DirRight, assets.GetTexture(q.image)));
+                vehicles.back()->SetEntryTime(q.entryTime);
+                queue.PopFront();
+            }
+        }
+    }
+
+    // A car for a new trip: a parked one when there is one, so steady traffic does not allocate
+    std::unique_ptr<Vehicle> TakeCar(float x, float y, float speed, Color color, bool dirRight, const Texture2D* texture) {
+        if (spareCars.empty()) return std::make_unique<Car>(x, y, speed, color, dirRight, texture);
+        std::unique_ptr<Vehicle> car = std::move(spareCars.back());
+        spareCars.pop_back();
+        static_cast<Car&>(*car).Reset(x, y, speed, color, dirRight, texture);
+        return car;
+    }
+
+    // Removes the cars for which remove(car) is true, keeping the others in order,
+    // and parks them in spareCars
+    template <typename Pred>
+    void EraseCars(std::vector<std::unique_ptr<Vehicle>>& cars, Pred remove) {
+        size_t kept = 0;
+        for (size_t i = 0; i < cars.size(); ++i) {
+            if (remove(cars[i])) {
+                spareCars.push_back(std::move(cars[i]));
+                continue;
+            }
+            if (kept != i) cars[kept] = std::move(cars[i]);
+            ++kept;
+        }
+        cars.erase(cars.begin() + kept, cars.end());
+    }
+
+    // Every car that entered is still queued, on the road or counted as gone
+    void CheckConservation() const {
+        size_t queued = 0;
+        for (int lane = 0; lane < 3; ++lane) queued += entryTop[lane].Size() + entryBottom[lane].Size();
+        size_t total = queued + vehiclesTop.size() + vehiclesBottom.size() + carsExited;
+        if (total != carsEntered) {
+            fprintf(stderr, "Car count mismatch: %zu entered, %zu accounted for\n", carsEntered, total);
+            abort();
+        }
+    }
+
+    void Attach(Vehicle* parent, Vehicle* child, float offsetX) {
+        child->SetFlag(VF_TOWED, true);
+        heat.Remove(*child);
+        child->SetY(parent->GetY());
+        towLinks.push_back({ parent, child, offsetX });
+    }
+
+    // Drops every link that mentions v. Children of a removed parent go with it.
+    void Detach(const Vehicle* v) {
+        for (auto& link : towLinks)
+            if (link.parent == v) link.child->SetFlag(VF_REMOVE, true);
+        towLinks.erase(std::remove_if(towLinks.begin(), towLinks.end(),
+            [v](const TowLink& link) { return link.parent == v || link.child == v; }), towLinks.end());
+        if (v == towTruck) towTruck = nullptr;
+    }
+
 public:
+    // Red light at the stop line, or the leader in the same lane is too close.
+    // When the road is calm (allowSkip), a car far from its leader and from the
+    // light zone only re-checks once it could have closed that distance: leaders
+    // never move backwards, so it cannot need to stop any earlier.
+    // leaderGap() returns the distance to the leader and is only called when needed.
+    template <bool DirRight, typename LeaderGapFn>
+    static bool MustStop(Vehicle& v, const TrafficLight& light, bool allowSkip, LeaderGapFn leaderGap) {
+        if (!allowSkip) v.SetFreeFlowFrames(0);
+        if (v.GetFreeFlowFrames() > 0) {
+            v.SetFreeFlowFrames(v.GetFreeFlowFrames() - 1);
+            return false;
+        }
+
+        float stopX = light.GetStopLineX(!DirRight);
+        if (light.IsRed() && fabs(v.GetX() - stopX) < 50) return true;
+
+        float room = leaderGap() - VEHICLE_WIDTH - SAFE_DISTANCE;
+        if (room < 0) return true;
+
+        float toLightZone = Heading<DirRight>::Ahead(v.GetX(), stopX) - 50;
+        if (toLightZone > -100) room = std::min(room, toLightZone);  // Zone not passed yet
+        if (allowSkip && room > 0 && v.GetSpeed() > 0)
+            v.SetFreeFlowFrames((int)std::min(room / v.GetSpeed() - 1, (float)MAX_FREE_FLOW_FRAMES));
+        return false;
+    }
+
+    // Calls fn(Vehicle&) for every service vehicle
+    template <typename Fn>
+    void ForEachService(Fn fn) const {
+        for (auto& a : ambulances) fn(*a);
+        for (auto& t : towTrucks) fn(*t);
+    }
+
     Simulation() :
         lightTop(SCREEN_WIDTH / 2 - 80, ROAD_Y_TOP - 80, 5.0f),
         lightBottom(SCREEN_WIDTH / 2 - 150, ROAD_Y_BOTTOM + ROAD_HEIGHT + 20, 5.0f),
-        carSpawnTimerTop(0.0f), carSpawnTimerBottom(0.0f) 
+        roadTop(lightTop),
+        roadBottom(lightBottom)
     {
         for (int i = 0; i < 3; i++) {
             laneYTop[i] = (float)ROAD_Y_TOP + 10.0f + i * (float)LANE_HEIGHT;
@@ -338,43 +2143,100 @@ public:
     }
 
     void Init() {
-        siren = LoadSound("siren.wav");
-        srand((unsigned int)time(nullptr));
-        hospitalTexture = LoadTexture("hospital.png");
+        assets.StartLoading(Pool());
+        metrics = std::make_unique<MetricStore>();
+        Seed((uint64_t)time(nullptr));
+        ReserveStep();
+    }
+
+    // Room for everything a step fills, and parked cars for both roads, so a
+    // warmed-up step does not allocate
+    void ReserveStep() {
+        vehiclesTop.reserve(STEP_RESERVED_VEHICLES);
+        vehiclesBottom.reserve(STEP_RESERVED_VEHICLES);
+        spareCars.reserve(2 * STEP_RESERVED_VEHICLES);
+        while (spareCars.size() < 2 * STEP_RESERVED_VEHICLES)
+            spareCars.push_back(std::make_unique<Car>(0.0f, 0.0f, 0.0f, WHITE, true, nullptr));
+        snapTop.Reserve(STEP_RESERVED_VEHICLES);
+        snapBottom.Reserve(STEP_RESERVED_VEHICLES);
+        towLinks.reserve(4);
+        events.Reserve(STEP_RESERVED_EVENTS);
+        roadTop.Reserve(STEP_RESERVED_EVENTS);
+        roadBottom.Reserve(STEP_RESERVED_EVENTS);
+        for (int lane = 0; lane < 3; ++lane) {
+            entryTop[lane].Reserve(STEP_RESERVED_EVENTS);
+            entryBottom[lane].Reserve(STEP_RESERVED_EVENTS);
+        }
     }
 
-    void SpawnCarTop() {
-        int lane = GetRandomValue(0, 2);
-        float speed = 2.0f + GetRandomValue(0, 5) / 10.0f;
-        Color c = { (unsigned char)GetRandomValue(80, 255), (unsigned char)GetRandomValue(80, 255), (unsigned char)GetRandomValue(80, 255), 255 };
-        vehiclesTop.push_back(std::make_unique<Car>(-200, laneYTop[lane], speed, c, true, carImages[GetRandomValue(0, 4)]));
+    // Before the first Update. Each road process draws from its own stream.
+    void Seed(uint64_t seed) {
+        rng = seed ? seed : 1;  // xorshift state must not be 0
+        roadTop.Seed(seed * 0x9E3779B97F4A7C15ull + 1);
+        roadBottom.Seed(seed * 0x9E3779B97F4A7C15ull + 2);
     }
 
-    void SpawnCarBottom() {
-        int lane = GetRandomValue(0, 2);
-        float speed = 2.0f + GetRandomValue(0, 5) / 10.0f;
-        Color c = { (unsigned char)GetRandomValue(80, 255), (unsigned char)GetRandomValue(80, 255), (unsigned char)GetRandomValue(80, 255), 255 };
-        vehiclesBottom.push_back(std::make_unique<Car>(SCREEN_WIDTH + 200, laneYBottom[lane], speed, c, false, carImages[GetRandomValue(0, 4)]));
+    // Hands the lights to SetSignalPhase; the timed cycle stops
+    void TakeSignalControl() {
+        roadTop.TakeSignalControl();
+        roadBottom.TakeSignalControl();
+    }
+    void SetRandomIncidents(bool on) { randomIncidents = on; }
+    // Runs parallel work on 'shared' (which must outlive this) instead of an own pool
+    void UsePool(TaskPool& shared) { sharedPool = &shared; }
+
+    // Takes effect in the next Update. A road process that already ran past
+    // the current time rolls back.
+    void SetSignalPhase(bool topRed, bool bottomRed) {
+        if (lightTop.IsRed() != topRed) roadTop.SetPhase(simTime, topRed);
+        if (lightBottom.IsRed() != bottomRed) roadBottom.SetPhase(simTime, bottomRed);
+    }
+
+    size_t RolledBackEvents() const { return roadTop.RolledBack() + roadBottom.RolledBack(); }
+
+    // Writes ENV_OBS_SIZE values to 'out' and returns the reward: minus the
+    // number of vehicles standing still
+    float Observe(float* out) const {
+        float queue[6] = {}, occupancy[6] = {};
+        auto count = [&](const Vehicle& v, bool top) {
+            if (v.Has(VF_TOWED)) return;
+            int lane = LodLane(v, top);
+            occupancy[lane] += 1.0f;
+            if (!v.IsMoving() || v.Has(VF_FORCED_STOP | VF_CRASHED)) queue[lane] += 1.0f;
+        };
+        for (auto& v : vehiclesTop) count(*v, true);
+        for (auto& v : vehiclesBottom) count(*v, false);
+        ForEachService([&](const Vehicle& v) { count(v, false); });
+        float stopped = 0.0f;
+        for (int lane = 0; lane < 6; ++lane) {
+            stopped += queue[lane];
+            out[lane] = queue[lane] / ENV_LANE_CAPACITY;
+            out[6 + lane] = occupancy[lane] / ENV_LANE_CAPACITY;
+        }
+        out[12] = lightTop.IsRed() ? 1.0f : 0.0f;
+        out[13] = (float)(simTime - topChangedAt);
+        out[14] = lightBottom.IsRed() ? 1.0f : 0.0f;
+        out[15] = (float)(simTime - bottomChangedAt);
+        return -stopped;
     }
 
     // UPDATED: Smooth accident creation with visual chase
-    void TriggerRandomAccident() {
-        if (currentAccident.active || currentAccident.pending) return;
+    // Returns true if two cars were set on a collision course
+    bool TriggerRandomAccident() {
+        if (currentAccident.active || currentAccident.pending) return false;
 
         // Find two cars in same lane, close enough to force a crash
         for (size_t i = 0; i < vehiclesBottom.size(); i++) {
             Vehicle* v1 = vehiclesBottom[i].get(); // Potential Rear
-            if (v1->IsAmbulance() || v1->IsDepannage() || v1->IsOffScreen()) continue;
             // FIX 2: Never pick cars already towed or crashed for a NEW accident
-            if (v1->isTowed || v1->isCrashed) continue;
+            if (v1->Has(VF_TOWED | VF_CRASHED) || v1->IsOffScreen<false>()) continue;
 
             for (size_t j = 0; j < vehiclesBottom.size(); j++) {
                 if (i == j) continue;
                 Vehicle* v2 = vehiclesBottom[j].get(); // Potential Front
 
-                if (v2->IsAmbulance() || v2->IsDepannage() || v2->IsOffScreen()) continue;
                 // FIX 2: Never pick cars already towed or crashed for a NEW accident
-                if (v2->isTowed || v2->isCrashed) continue;
+                if (v2->Has(VF_TOWED | VF_CRASHED) || v2->IsOffScreen<false>()) continue;
 
                 // Same lane?
                 if (fabs(v1->GetTargetY() - v2->GetTargetY()) < 5.0f) {
@@ -394,22 +2256,19 @@ public:
                             currentAccident.car2 = v1; // Rear
                             
                             // LOCK VEHICLES
-                            v1->isReckless = true;
-                            v2->isAccidentTarget = true;
-                            v1->laneLock = true; 
-                            v2->laneLock = true; 
+                            v1->SetFlag(VF_RECKLESS | VF_LANE_LOCK, true);
+                            v2->SetFlag(VF_ACCIDENT_TARGET | VF_LANE_LOCK, true);
 
                             // Make rear car reckless!
                             v1->SetSpeed(v1->GetSpeed() * 2.8f); 
                             v2->SetSpeed(v2->GetSpeed() * 0.4f);
-                            
-                            std::cout << "Accident Pending initiated!" << std::endl;
-                            return;
+                            return true;
                         }
                     }
                 }
             }
         }
+        return false;
     }
 
     void CallAmbulance() {
@@ -417,112 +2276,115 @@ public:
             TriggerRandomAccident(); 
         }
 
-        PlaySound(siren);
+        PlaySound(assets.GetSound(SND_SIREN));
+        if (responseStart < 0.0) responseStart = simTime;
         // Spawn ambulance
-        auto amb = std::make_unique<Ambulance>(SCREEN_WIDTH + 200, laneYBottom[1], 4.5f, false);
+        auto amb = std::make_unique<Ambulance>(SCREEN_WIDTH + 200, laneYBottom[1], 4.5f, assets.GetTexture(TEX_AMBULANCE));
         
         // If accident is active, assign immediately
         if (currentAccident.active) {
-            amb->AssignAccident(currentAccident.x, currentAccident.y);
+            amb->AssignAccident(currentAccident.x, currentAccident.y, simTime);
             amb->SetTargetY(currentAccident.y);
         }
         
-        vehiclesBottom.push_back(std::move(amb));
+        ambulances.push_back(std::move(amb));
         ambulanceActive = true;
     }
 
     void CallDepannage() {
         if (!currentAccident.active) return;
-        auto tow = std::make_unique<Depannage>(SCREEN_WIDTH + 200, currentAccident.y, 3.5f);
+        auto tow = std::make_unique<Depannage>(SCREEN_WIDTH + 200, currentAccident.y, 3.5f, assets.GetTexture(TEX_DEPANNAGE));
         tow->SetTarget(currentAccident.x);
-        vehiclesBottom.push_back(std::move(tow));
+        towTruck = tow.get();
+        towTrucks.push_back(std::move(tow));
     }
 
     void Update(float delta) {
-        // --- 1. CLEANUP ORPHANED TOWED CARS ---
-        // FIX 1: Before anything else, check if there is an active Tow Truck on screen.
-        // If not (or if it's too far gone), mark all "Towed" cars for immediate removal.
-        // This prevents the "Tow truck arriving with cars already" bug.
-        
-        Depannage* ptrTow = nullptr;
-        for (auto& v : vehiclesBottom) if (v->IsDepannage()) ptrTow = (Depannage*)v.get();
-        
-        // If tow truck is missing OR it is about to be deleted (x < -600), 
-        // then any cars marked 'isTowed' must be deleted NOW.
-        bool towTruckGone = (ptrTow == nullptr) || (ptrTow->GetX() < -600.0f);
-
-        if (towTruckGone) {
-            for (auto& v : vehiclesBottom) {
-                if (v->isTowed) {
-                    v->toBeRemoved = true; 
-                }
-            }
+        assets.UploadReady(ASSET_UPLOAD_BUDGET_MS);
+        auto stepStart = std::chrono::steady_clock::now();
+
+        // --- 1. CLEANUP TOWED CARS ---
+        // Once the tow truck is far enough gone, its cars leave with it.
+        if (towTruck && towTruck->GetX() < -600.0f) {
+            for (auto& link : towLinks)
+                if (link.parent == towTruck) link.child->SetFlag(VF_REMOVE, true);
         }
 
 
-        carSpawnTimerTop += delta;
-        // ADJUSTED TRAFFIC: Spawn every 2.0s - 3.5s
-        if (carSpawnTimerTop >= GetRandomValue(20, 35) / 10.0f) { 
-            carSpawnTimerTop = 0.0f; 
-            SpawnCarTop(); 
-        } 
-        
-        carSpawnTimerBottom += delta;
-        // ADJUSTED TRAFFIC: Spawn every 2.0s - 3.5s
-        if (carSpawnTimerBottom >= GetRandomValue(20, 35) / 10.0f) { 
-            carSpawnTimerBottom = 0.0f; 
-            SpawnCarBottom(); 
-        }
+        simTime += delta;
+
+        SimEvent ev;
+        while (events.PopDue(simTime, ev)) HandleEvent(ev);
+        AdvanceRoads();
+
+        ReleaseEntries<true>(entryTop, laneYTop, vehiclesTop, -200.0f);
+        ReleaseEntries<false>(entryBottom, laneYBottom, vehiclesBottom, SCREEN_WIDTH + 200.0f);
 
         // Low chance of random accident
-        if (GetRandomValue(0, 1000) < 2) TriggerRandomAccident();
+        if (randomIncidents && Random(0, 1000) < 2) TriggerRandomAccident();
 
-        lightTop.Update(delta);
-        lightBottom.Update(delta);
 
         // --- Remove off screen vehicles ---
-        vehiclesTop.erase(std::remove_if(vehiclesTop.begin(), vehiclesTop.end(),
-            [](const std::unique_ptr<Vehicle>& v) { return v->IsOffScreen(); }), vehiclesTop.end());
+        // Keep Depannage truck alive longer; its towed cars are flagged to go with it
+        towTrucks.erase(std::remove_if(towTrucks.begin(), towTrucks.end(), [&](const std::unique_ptr<Depannage>& t) {
+            if (t->GetX() >= -600.0f) return false;
+            Detach(t.get());
+            heat.Remove(*t);
+            return true;
+        }), towTrucks.end());
+        ambulances.erase(std::remove_if(ambulances.begin(), ambulances.end(), [this](const std::unique_ptr<Ambulance>& a) {
+            if (!a->IsOffScreen<false>()) return false;
+            heat.Remove(*a);
+            return true;
+        }), ambulances.end());
+
+        size_t onRoad = vehiclesTop.size() + vehiclesBottom.size();
+        double travelSum = 0.0;  // Network travel time of the cars leaving this step
+        auto leave = [&](Vehicle& v) {
+            travelSum += simTime - v.GetEntryTime();
+            heat.Remove(v);
+            return true;
+        };
+        EraseCars(vehiclesTop, [&](const std::unique_ptr<Vehicle>& v) { return Heading<true>::OffScreen(v->GetX()) && leave(*v); });
         
         // SAFE REMOVAL: Fixes Segfault and Ghost Accidents
-        vehiclesBottom.erase(std::remove_if(vehiclesBottom.begin(), vehiclesBottom.end(),
-            [&](const std::unique_ptr<Vehicle>& v) { 
+        EraseCars(vehiclesBottom, [&](const std::unique_ptr<Vehicle>& v) {
+            // Do NOT delete cars involved in accident sequence
+            if (v->Has(VF_IN_ACCIDENT)) {
+                // However, if they are WAY off screen, let them go
+                if (v->GetX() > -600.0f && !v->Has(VF_REMOVE)) return false;
                 
-                // Keep Depannage truck alive longer
-                if (v->IsDepannage()) {
-                    return v->GetX() < -600.0f; 
-                }
+                // IF we are deleting them now, clear pointers to prevent dangling usage
+                if (v.get() == currentAccident.car1) currentAccident.car1 = nullptr;
+                if (v.get() == currentAccident.car2) currentAccident.car2 = nullptr;
                 
-                // Do NOT delete cars involved in accident sequence
-                if (v->isReckless || v->isAccidentTarget || v->isCrashed || v->isTowed) {
-                    // However, if they are WAY off screen, let them go
-                    if (v->GetX() > -600.0f && !v->toBeRemoved) return false;
-                    
-                    // IF we are deleting them now, clear pointers to prevent dangling usage
-                    if (v.get() == currentAccident.car1) currentAccident.car1 = nullptr;
-                    if (v.get() == currentAccident.car2) currentAccident.car2 = nullptr;
-                    
-                    // If we delete accident cars, accident is over
-                    if (v->isAccidentTarget || v->isReckless || v->isCrashed) {
-                        currentAccident.pending = false; 
-                        currentAccident.active = false;
-                    }
-                    return true;
+                // If we delete accident cars, accident is over
+                if (v->Has(VF_ACCIDENT_TARGET | VF_RECKLESS | VF_CRASHED)) {
+                    currentAccident.pending = false; 
+                    currentAccident.active = false;
                 }
+                if (v->Has(VF_TOWED)) Detach(v.get());
+                return leave(*v);
+            }
 
-                // Normal check
-                if (v->IsOffScreen() || v->toBeRemoved) {
-                    // Double check we aren't deleting a pointer we hold
-                    if (v.get() == currentAccident.car1 || v.get() == currentAccident.car2) {
-                        currentAccident.car1 = nullptr;
-                        currentAccident.car2 = nullptr;
-                        currentAccident.pending = false;
-                        currentAccident.active = false;
-                    }
-                    return true;
+            // Normal check
+            if (v->IsOffScreen<false>() || v->Has(VF_REMOVE)) {
+                // Double check we aren't deleting a pointer we hold
+                if (v.get() == currentAccident.car1 || v.get() == currentAccident.car2) {
+                    currentAccident.car1 = nullptr;
+                    currentAccident.car2 = nullptr;
+                    currentAccident.pending = false;
+                    currentAccident.active = false;
                 }
-                return false;
-            }), vehiclesBottom.end());
+                return leave(*v);
+            }
+            return false;
+        });
+        size_t exits = onRoad - vehiclesTop.size() - vehiclesBottom.size();
+        carsExited += exits;
+#ifdef SIM_DEBUG
+        CheckConservation();
+#endif
 
 
         // --- Pending Accident Logic (The Collision) ---
@@ -539,23 +2401,23 @@ public:
                     currentAccident.pending = false;
                     currentAccident.active = true;
                     
-                    currentAccident.car1->isCrashed = true;
-                    currentAccident.car2->isCrashed = true;
-                    currentAccident.car2->isReckless = false; 
+                    currentAccident.car1->SetFlag(VF_CRASHED, true);
+                    currentAccident.car2->SetFlag(VF_CRASHED, true);
+                    currentAccident.car2->SetFlag(VF_RECKLESS, false); 
                     
                     // Stop them
                     currentAccident.car1->SetMoving(false);
                     currentAccident.car2->SetMoving(false);
+                    TrackHeat(*currentAccident.car1, false);
+                    TrackHeat(*currentAccident.car2, false);
                     
                     // Align visually
                     currentAccident.x = currentAccident.car1->GetX() + (VEHICLE_WIDTH/2);
                     currentAccident.y = currentAccident.car1->GetY();
 
-                     for (auto& v : vehiclesBottom) {
-                        if (v->IsAmbulance()) {
-                            static_cast<Ambulance*>(v.get())->AssignAccident(currentAccident.x, currentAccident.y);
-                            v->SetTargetY(currentAccident.y);
-                        }
+                    for (auto& amb : ambulances) {
+                        amb->AssignAccident(currentAccident.x, currentAccident.y, simTime);
+                        amb->SetTargetY(currentAccident.y);
                     }
                 }
             } else {
@@ -567,41 +2429,30 @@ public:
 
 
         // --- Bottom Road Special Logic ---
-        Ambulance* activeAmbulance = nullptr;
-        Depannage* activeTow = nullptr;
-
-        for (auto& v : vehiclesBottom) {
-            if (v->IsAmbulance()) activeAmbulance = static_cast<Ambulance*>(v.get());
-            if (v->IsDepannage()) activeTow = static_cast<Depannage*>(v.get());
-        }
+        Ambulance* activeAmbulance = ambulances.empty() ? nullptr : ambulances.back().get();
+        Depannage* activeTow = towTruck;
 
         // 1. Tow Truck Logic
         if (activeTow) {
-            if (activeTow->hasPickedUp && currentAccident.active) {
+            if (activeTow->HasPickedUp() && currentAccident.active) {
                 // Attach cars to tow truck
                 if (currentAccident.car1) {
-                    currentAccident.car1->isTowed = true;
-                    currentAccident.car1->isCrashed = false; 
-                    currentAccident.car1->isAccidentTarget = false; 
-                    currentAccident.car1->towOffsetX = 100.0f; 
-                    currentAccident.car1->SetY(activeTow->GetY()); 
+                    currentAccident.car1->SetFlag(VF_CRASHED, false); 
+                    currentAccident.car1->SetFlag(VF_ACCIDENT_TARGET, false); 
+                    Attach(activeTow, currentAccident.car1, 100.0f);
                 }
                 if (currentAccident.car2) {
-                    currentAccident.car2->isTowed = true;
-                    currentAccident.car2->isCrashed = false;
-                    currentAccident.car2->towOffsetX = 200.0f; 
-                    currentAccident.car2->SetY(activeTow->GetY());
+                    currentAccident.car2->SetFlag(VF_CRASHED, false);
+                    Attach(activeTow, currentAccident.car2, 200.0f);
                 }
                 currentAccident.active = false; 
             }
         }
         
-        // Update Towed Cars Positions
-        for (auto& v : vehiclesBottom) {
-            if (v->isTowed && activeTow) {
-                v->SetX(activeTow->GetX() + v->towOffsetX);
-                v->SetY(activeTow->GetY()); 
-            }
+        // Update Towed Cars Positions (parents first, so chains resolve in one pass)
+        for (auto& link : towLinks) {
+            link.child->SetX(link.parent->GetX() + link.offsetX);
+            link.child->SetY(link.parent->GetY());
         }
 
 
@@ -616,14 +2467,33 @@ public:
         }
 
         // 3. General Traffic Loop
-        for (size_t i = 0; i < vehiclesBottom.size(); ++i) {
+        // Lane changes and reckless drivers can put a new leader anywhere, so the
+        // bottom road only uses reduced-rate checks when nothing special is going on.
+        bool calmBottom = !activeAmbulance && !towTruck && !currentAccident.active && !currentAccident.pending;
+        // Parked vehicles waiting on a timer are left alone until their wake event
+        for (auto& a : ambulances) {
+            if (a->IsAsleep()) continue;
+            if (a->UpdateService<false>(simTime)) ScheduleWake(*a);
+            TrackHeat(*a, false);
+        }
+        for (auto& t : towTrucks) {
+            if (t->IsAsleep()) continue;
+            if (t->UpdateService<false>(simTime)) ScheduleWake(*t);
+            TrackHeat(*t, false);
+        }
+        // Cars follow service vehicles too: their entries go after the cars'
+        snapBottom.Build(vehiclesBottom);
+        ForEachService([this](const Vehicle& v) { snapBottom.Append(v); });
+        // Crashed and towed cars are placed by the accident logic, not driven
+        ArenaVector<uint32_t> driven(vehiclesBottom.size(), 0, ArenaAllocator<uint32_t>(&stepArena));
+        size_t drivenCount = snapBottom.Without(VF_CRASHED | VF_TOWED, vehiclesBottom.size(), driven.data());
+        for (size_t k = 0; k < drivenCount; ++k) {
+            size_t i = driven[k];
             auto& v = vehiclesBottom[i];
 
-            if (v->isCrashed || v->isTowed) continue; 
-            if (v->IsAmbulance() || v->IsDepannage()) { v->Update(); continue; }
-
             // YIELD LOGIC START
-            if (!v->isReckless && !v->laneLock && !v->HasChangedLane()) {
+            // A car's own flags only change in its own iteration, so the snapshot word is current
+            if ((snapBottom.flags[i] & VF_NO_YIELD) == 0) {
                 auto tryYield = [&](Vehicle* emergencyVehicle) {
                     if (emergencyVehicle && emergencyVehicle->IsMoving()) {
                          // Check same lane
@@ -651,9 +2521,9 @@ public:
             bool stop = false;
 
             // Collision Check
-            if (!v->isReckless) {
+            if (!v->Has(VF_RECKLESS)) {
                 // Accident Avoidance - FIX: Dont let locked cars dodge
-                if (currentAccident.active && !v->HasChangedLane() && !v->laneLock) {
+                if (currentAccident.active && !v->Has(VF_CHANGED_LANE | VF_LANE_LOCK)) {
                     if (fabs(v->GetY() - currentAccident.y) < 5.0f && v->GetX() > currentAccident.x) {
                         if (v->GetX() - currentAccident.x < 300) {
                             int currentLaneIdx = 0;
@@ -666,53 +2536,27 @@ public:
                     }
                 }
                 
-                // Traffic light
-                float stopX = lightBottom.GetStopLineX(true);
-                if (lightBottom.IsRed() && fabs(v->GetX() - stopX) < 50) stop = true;
-                
-                // Car Collision
-                if (!stop) {
-                    for (size_t j = 0; j < vehiclesBottom.size(); ++j) {
-                        if (i == j) continue;
-                        auto& other = vehiclesBottom[j];
-                        if (other->isTowed) continue; 
-
-                        if (fabs(v->GetTargetY() - other->GetTargetY()) < 5.0f) {
-                            if (other->GetX() < v->GetX()) { 
-                                float frontOfOther = other->GetX() + VEHICLE_WIDTH;
-                                if (v->GetX() - frontOfOther < SAFE_DISTANCE) {
-                                    stop = true; 
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                }
+                // Traffic light and car collision
+                stop = MustStop<false>(*v, lightBottom, calmBottom,
+                                       [this, &v] { return snapBottom.LeaderGap<false>(v->GetX(), v->GetTargetY()); });
             } 
             else {
                 // Reckless driver logic: Ignore safety
             }
             
             v->SetForcedStop(stop);
-            v->Update(stop);
+            v->UpdateDir<false>(stop);
+            snapBottom.Store(i, *v);
+            TrackHeat(*v, false);
         }
 
         // Top Road
-        for (size_t i = 0; i < vehiclesTop.size(); ++i) {
-             auto& v = vehiclesTop[i];
-             bool stop = false;
-             if (lightTop.IsRed() && fabs(v->GetX() - lightTop.GetStopLineX(false)) < 50) stop = true;
-             if (!stop) {
-                 for (size_t j = 0; j < vehiclesTop.size(); ++j) {
-                     if (i == j) continue;
-                     if (vehiclesTop[j]->GetTargetY() == v->GetTargetY() && vehiclesTop[j]->GetX() > v->GetX()) {
-                         if (vehiclesTop[j]->GetX() - VEHICLE_WIDTH - v->GetX() < SAFE_DISTANCE) { stop = true; break; }
-                     }
-                 }
-             }
-             v->SetForcedStop(stop);
-             v->Update(stop);
-        }
+        UpdateTopRoad();
+
+        if (diagram.IsVisible()) SampleDiagram();
+        if (heat.IsVisible()) heat.Step();
+
+        stepArena.Reset();
 
         ambulanceActive = (activeAmbulance != nullptr);
         if (ambulanceActive) {
@@ -724,55 +2568,810 @@ public:
         } else {
             screenAlertOn = false;
         }
+
+        RecordMetrics(activeAmbulance, exits, travelSum, stepStart);
+    }
+
+    void RecordMetrics(const Ambulance* ambulance, size_t exits, double travelSum,
+                       std::chrono::steady_clock::time_point stepStart) {
+        if (!metrics) return;
+        float speedSum = 0.0f;
+        size_t count = 0, stopped = 0;
+        auto sample = [&](const Vehicle& v) {
+            if (v.Has(VF_CRASHED | VF_TOWED)) return;
+            bool still = !v.IsMoving() || v.Has(VF_FORCED_STOP);
+            speedSum += still ? 0.0f : v.GetSpeed();
+            stopped += still;
+            ++count;
+        };
+        for (auto& v : vehiclesTop) sample(*v);
+        for (auto& v : vehiclesBottom) sample(*v);
+        ForEachService(sample);
+        metrics->Append(METRIC_FLOW, simTime, (float)exits);
+        metrics->Append(METRIC_SPEED, simTime, count ? speedSum / count : 0.0f);
+        metrics->Append(METRIC_QUEUE, simTime, (float)stopped);
+        if (exits > 0) metrics->Append(METRIC_TRAVEL, simTime, (float)(travelSum / exits));
+        if (responseStart >= 0.0 && ambulance && ambulance->state == WAIT_AT_ACCIDENT) {
+            metrics->Append(METRIC_RESPONSE, simTime, (float)(simTime - responseStart));
+            responseStart = -1.0;
+        }
+        // The current frame has not been drawn yet, so these are the last complete one's
+        const AllocFrameStats& allocs = AllocTracker::LastFrame();
+        metrics->Append(METRIC_UPDATE_ALLOCS, simTime, (float)allocs.count[PHASE_UPDATE]);
+        metrics->Append(METRIC_DRAW_ALLOCS, simTime, (float)allocs.count[PHASE_DRAW]);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stepStart).count();
+        metrics->Append(METRIC_STEP_MS, simTime, (float)ms);
+    }
+
+    enum LodTier { LOD_CULLED, LOD_SPRITE, LOD_QUAD, LOD_STRIP };
+
+    static int LodChunk(float x) {
+        return std::min(std::max((int)((x - LOD_WORLD_MIN_X) / LOD_CHUNK_WIDTH), 0), LOD_CHUNKS - 1);
+    }
+
+    // Lanes 0-2 are the top road, 3-5 the bottom one
+    static int LodLane(const Vehicle& v, bool top) {
+        int lane = (int)((v.GetY() - (top ? ROAD_Y_TOP : ROAD_Y_BOTTOM)) / LANE_HEIGHT);
+        return (top ? 0 : 3) + std::min(std::max(lane, 0), 2);
+    }
+
+    template <bool DirRight>
+    static void DrawAtTier(const Vehicle& v, const LodTier (&tier)[LOD_CHUNKS]) {
+        LodTier t = tier[LodChunk(v.GetX())];
+        if (t == LOD_SPRITE) v.Draw<DirRight>();
+        else if (t == LOD_QUAD) v.DrawQuad();
+    }
+
+    // Each lane chunk gets one tier from the camera scale: sprites close up, flat quads
+    // at medium range, and one density strip per chunk when far, so a zoomed-out view
+    // costs a fixed number of rectangles whatever the vehicle count. Chunks outside
+    // the view are skipped.
+    void DrawVehicles() const {
+        LodTier zoomTier = camera.zoom >= LOD_SPRITE_ZOOM ? LOD_SPRITE
+                         : camera.zoom >= LOD_QUAD_ZOOM ? LOD_QUAD : LOD_STRIP;
+        zoomTier = (LodTier)std::min(zoomTier + lodBias, (int)LOD_STRIP);
+        Vector2 viewMin = GetScreenToWorld2D({ 0.0f, 0.0f }, camera);
+        Vector2 viewMax = GetScreenToWorld2D({ (float)SCREEN_WIDTH, (float)SCREEN_HEIGHT }, camera);
+
+        LodTier tier[LOD_CHUNKS];
+        for (int c = 0; c < LOD_CHUNKS; ++c) {
+            float x0 = LOD_WORLD_MIN_X + c * LOD_CHUNK_WIDTH;
+            bool visible = x0 + LOD_CHUNK_WIDTH + VEHICLE_WIDTH >= viewMin.x && x0 <= viewMax.x;
+            tier[c] = visible ? zoomTier : LOD_CULLED;
+        }
+
+        if (zoomTier != LOD_STRIP) {
+            for (auto& v : vehiclesTop) DrawAtTier<true>(*v, tier);
+            for (auto& v : vehiclesBottom) DrawAtTier<false>(*v, tier);
+            ForEachService([&tier](const Vehicle& v) { DrawAtTier<false>(v, tier); });
+            return;
+        }
+
+        int count[6][LOD_CHUNKS] = {};
+        for (auto& v : vehiclesTop) ++count[LodLane(*v, true)][LodChunk(v->GetX())];
+        for (auto& v : vehiclesBottom) ++count[LodLane(*v, false)][LodChunk(v->GetX())];
+        ForEachService([&count](const Vehicle& v) { ++count[LodLane(v, false)][LodChunk(v.GetX())]; });
+
+        const float capacity = LOD_CHUNK_WIDTH / (VEHICLE_WIDTH + SAFE_DISTANCE);
+        for (int lane = 0; lane < 6; ++lane) {
+            float laneTop = (float)(lane < 3 ? ROAD_Y_TOP : ROAD_Y_BOTTOM) + (lane % 3) * LANE_HEIGHT;
+            for (int c = 0; c < LOD_CHUNKS; ++c) {
+                if (tier[c] == LOD_CULLED || count[lane][c] == 0) continue;
+                float density = std::min(count[lane][c] / capacity, 1.0f);
+                Color shade = { (unsigned char)(255 * density), (unsigned char)(255 * (1.0f - density)), 0, 220 };
+                DrawRectangleRec({ LOD_WORLD_MIN_X + c * LOD_CHUNK_WIDTH, laneTop + 2, LOD_CHUNK_WIDTH, LANE_HEIGHT - 4.0f }, shade);
+            }
+        }
+    }
+
+    // Call where v moved or changed speed
+    void TrackHeat(Vehicle& v, bool top) {
+        // Towed cars ride on the truck and are not traffic of their own
+        if (v.Has(VF_TOWED)) {
+            heat.Remove(v);
+            return;
+        }
+        bool stopped = !v.IsMoving() || v.Has(VF_FORCED_STOP | VF_CRASHED);
+        heat.Move(v, LaneHeatmap::Bin(LodLane(v, top), v.GetX()), stopped ? 0.0f : v.GetSpeed());
+    }
+
+    // One time-space diagram column from the current positions
+    void SampleDiagram() {
+        diagram.BeginColumn();
+        auto plot = [this](const Vehicle& v, bool top) {
+            bool stopped = !v.IsMoving() || v.Has(VF_FORCED_STOP | VF_CRASHED);
+            diagram.Plot(LodLane(v, top), v.GetX(), top, stopped);
+        };
+        for (auto& v : vehiclesTop) plot(*v, true);
+        for (auto& v : vehiclesBottom) plot(*v, false);
+        ForEachService([&plot](const Vehicle& v) { plot(v, false); });
+        diagram.EndColumn();
+    }
+
+    // Mouse wheel zooms around the cursor
+    void ZoomCamera() {
+        float wheel = GetMouseWheelMove();
+        if (wheel == 0.0f) return;
+        Vector2 mouse = GetMousePosition();
+        camera.target = GetScreenToWorld2D(mouse, camera);
+        camera.offset = mouse;
+        camera.zoom = std::min(std::max(camera.zoom * (1.0f + 0.1f * wheel), CAMERA_MIN_ZOOM), CAMERA_MAX_ZOOM);
     }
 
     void Draw() const {
+        BeginMode2D(camera);
         road.Draw();
         lightTop.Draw();
         lightBottom.Draw();
-        DrawTexture(hospitalTexture, 10, ROAD_Y_BOTTOM + ROAD_HEIGHT + 10, WHITE);
-        
-        for (auto& v : vehiclesTop) v->Draw();
-        for (auto& v : vehiclesBottom) v->Draw();
+        DrawTexture(*assets.GetTexture(TEX_HOSPITAL), 10, ROAD_Y_BOTTOM + ROAD_HEIGHT + 10, WHITE);
+        DrawVehicles();
+        if (heat.IsVisible()) heat.Draw();
+        EndMode2D();
+
+        if (diagram.IsVisible()) diagram.Draw(SCREEN_WIDTH - TSD_COLUMNS - 20, 130);
+        if (chartsVisible && metrics) metrics->Draw(20, 130, simTime);
 
         if (screenAlertOn) {
             DrawRectangle(0, 0, 20, SCREEN_HEIGHT, Fade(RED, 0.7f));
             DrawRectangle(SCREEN_WIDTH - 20, 0, 20, SCREEN_HEIGHT, Fade(RED, 0.7f));
         }
         
-        DrawText("Press 'E' for Ambulance", 10, 10, 20, WHITE);
-        DrawText("Press 'D' for Tow Truck", 10, 35, 20, WHITE);
-        DrawText("Press 'A' for Accident", 10, 60, 20, WHITE);
+        if (hudVisible) {
+            DrawText("Press 'E' for Ambulance", 10, 10, 20, WHITE);
+            DrawText("Press 'D' for Tow Truck", 10, 35, 20, WHITE);
+            DrawText("Press 'A' for Accident", 10, 60, 20, WHITE);
+            DrawText("Mouse wheel to zoom, 'R' to record, 'T' for time-space diagram, 'H' for heatmap", 10, 85, 20, WHITE);
+            DrawText("'G' for metric charts, 'X' to export metrics", 10, 110, 20, WHITE);
+
+            const AllocFrameStats& allocs = AllocTracker::LastFrame();
+            DrawText(TextFormat("Allocations last frame: update %llu (%llu B), draw %llu (%llu B)",
+                (unsigned long long)allocs.count[PHASE_UPDATE], (unsigned long long)allocs.bytes[PHASE_UPDATE],
+                (unsigned long long)allocs.count[PHASE_DRAW], (unsigned long long)allocs.bytes[PHASE_DRAW]),
+                10, SCREEN_HEIGHT - 25, 16, WHITE);
+        }
         
         if(currentAccident.active) DrawText("ACCIDENT ACTIVE!", SCREEN_WIDTH/2 - 100, 50, 20, RED);
         if(currentAccident.pending) DrawText("IMPACT IMMINENT...", SCREEN_WIDTH/2 - 110, 50, 20, ORANGE);
     }
 
+    void ToggleDiagram() { diagram.Toggle(); }
+    void ToggleCharts() { chartsVisible = !chartsVisible; }
+
+    // The buckets are copied here, between steps; the file is written on the pool
+    void ExportMetrics() {
+        if (!metrics) return;
+        Pool().Submit(PRIORITY_IO, [rows = metrics->Rows()] {
+            bool ok = MetricStore::WriteCsv(METRICS_CSV_FILE, rows);
+            std::cout << (ok ? "Wrote " : "Could not write ") << METRICS_CSV_FILE << std::endl;
+        });
+    }
+
+    // Hidden heatmaps keep their counts but do not smooth them
+    void ToggleHeatmap() {
+        heat.SetVisible(!heat.IsVisible());
+        heat.ClearSmoothed();
+    }
+
+    void ApplyGovernor(const FrameGovernor& governor) {
+        hudVisible = governor.ShowHud();
+        lodBias = governor.LodBias();
+        recorder.SetEvery(governor.RecordEvery());
+    }
+
+    void StartRecording(const char* prefix) { if (!recorder.IsActive()) recorder.Start(prefix); }
+    void StopRecording() { if (recorder.IsActive()) recorder.Stop(Pool()); }
+    void ToggleRecording() {
+        if (recorder.IsActive()) StopRecording();
+        else StartRecording("capture_");
+    }
+
+    // Draws the current state into the recorder, if it is running
+    void CaptureFrame() {
+        if (!recorder.IsActive() || !recorder.Due()) return;
+        recorder.BeginFrame();
+        ClearBackground(SKYBLUE);
+        Draw();
+        recorder.EndFrame(Pool());
+    }
+
+    // Blocks until every asset is uploaded, for runs that must not show placeholders
+    void WaitForAssets() {
+        while (!assets.IsResident()) {
+            assets.UploadReady(ASSET_UPLOAD_BUDGET_MS);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
     ~Simulation() {
-        UnloadSound(siren);
-        UnloadTexture(hospitalTexture);
+        StopRecording();
+        if (pool) {
+            for (size_t i = 0; i < pool->WorkerCount(); ++i) {
+                TaskPool::WorkerStats st = pool->GetStats(i);
+                std::cout << "Worker " << i << ": " << st.executed << " tasks, " << st.steals
+                          << " steals, " << st.idleSeconds << " s idle" << std::endl;
+            }
+            pool.reset();  // Finishes any decode still in flight before the assets go
+        }
+        diagram.Unload();
+        assets.Unload();
+    }
+};
+
+// Batch of headless simulations for training signal controllers. Step applies
+// one phase action per instance, advances every instance by one frame on the
+// task pool and writes observations and rewards straight into caller buffers.
+// Instances never touch the window, audio or textures, so they can run on any thread.
+// Random accidents are off: without a user calling the tow truck they would never clear.
+class SignalEnv {
+private:
+    std::vector<std::unique_ptr<Simulation>> sims;
+    std::vector<uint64_t> episodes;  // Resets per instance, so each episode gets its own seed
+    uint64_t seed;
+    TaskPool& pool;  // Shared with the caller; instances use it too
+
+public:
+    SignalEnv(TaskPool& tasks, size_t count, uint64_t baseSeed = 1)
+        : sims(count), episodes(count, 0), seed(baseSeed), pool(tasks) {
+        for (size_t i = 0; i < count; ++i) Reset(i);
+    }
+
+    size_t Size() const { return sims.size(); }
+
+    // Road events undone by signal inputs, over the current episodes
+    size_t RolledBackEvents() const {
+        size_t total = 0;
+        for (auto& sim : sims) total += sim->RolledBackEvents();
+        return total;
+    }
+
+    void Reset(size_t i) {
+        sims[i] = std::make_unique<Simulation>();
+        sims[i]->Seed(seed + 0x9E3779B97F4A7C15ull * (i + 1) + episodes[i]++);
+        sims[i]->TakeSignalControl();
+        sims[i]->SetRandomIncidents(false);
+        sims[i]->UsePool(pool);
+    }
+
+    // actions: Size() phase choices (bit 0 = top light green, bit 1 = bottom light green).
+    // observations: Size() * ENV_OBS_SIZE floats, rewards: Size() floats.
+    void Step(const int* actions, float* observations, float* rewards) {
+        // Several slices per thread, since crowded instances take longer to step
+        pool.ParallelFor(sims.size(), (pool.WorkerCount() + 1) * 4, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                Simulation& sim = *sims[i];
+                sim.SetSignalPhase((actions[i] & 1) == 0, (actions[i] & 2) == 0);
+                sim.Update(1.0f / TARGET_FPS);
+                rewards[i] = sim.Observe(observations + i * ENV_OBS_SIZE);
+            }
+        });
+    }
+};
+
+// Headless throughput check: 'count' environments driven by a fixed-time
+// controller that flips both lights every five seconds.
+int RunEnvBenchmark(size_t count, long steps) {
+    TaskPool pool;
+    SignalEnv env(pool, count);
+    std::vector<int> actions(count, 0);
+    std::vector<float> observations(count * ENV_OBS_SIZE);
+    std::vector<float> rewards(count);
+
+    double rewardSum = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for (long s = 0; s < steps; ++s) {
+        for (size_t i = 0; i < count; ++i) actions[i] = (s / (5 * TARGET_FPS)) % 2 ? 1 : 2;
+        env.Step(actions.data(), observations.data(), rewards.data());
+        for (float r : rewards) rewardSum += r;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << count << " environments x " << steps << " steps: " << count * steps / seconds
+              << " env-steps/s, mean reward " << rewardSum / (count * steps)
+              << ", road events rolled back " << env.RolledBackEvents() << std::endl;
+    return 0;
+}
+
+// Leader search over the live vehicle objects, as the car-following check did
+// before LaneSnapshot. Kept for the --bench comparison.
+template <bool DirRight>
+static float ObjectLeaderGap(const std::vector<std::unique_ptr<Vehicle>>& vehicles, const Vehicle& v) {
+    float best = FLT_MAX;
+    for (const auto& other : vehicles) {
+        if (other->Has(VF_TOWED)) continue;
+        float ahead = Heading<DirRight>::Ahead(v.GetX(), other->GetX());
+        if (ahead > 0.0f && fabsf(other->GetTargetY() - v.GetTargetY()) < 5.0f && ahead < best) best = ahead;
+    }
+    return best;
+}
+
+// Times the leader search for every vehicle of one crowded road with the
+// snapshot kernel, its scalar fallback and the per-object loop
+int RunGapBenchmark(size_t count, long rounds) {
+    std::vector<std::unique_ptr<Vehicle>> vehicles;
+    for (size_t i = 0; i < count; ++i) {
+        float x = (float)((i * 7919) % (SCREEN_WIDTH + 400)) - 200.0f;
+        float y = (float)ROAD_Y_TOP + 10.0f + (i % 3) * (float)LANE_HEIGHT;
+        vehicles.push_back(std::make_unique<Car>(x, y, 2.0f, WHITE, true, nullptr));
+    }
+    LaneSnapshot lane;
+    lane.Build(vehicles);
+
+    using Clock = std::chrono::steady_clock;
+    double checksum[3] = {};
+    double seconds[3] = {};
+    for (int method = 0; method < 3; ++method) {
+        auto start = Clock::now();
+        for (long r = 0; r < rounds; ++r) {
+            for (const auto& v : vehicles) {
+                float gap = method == 0 ? lane.LeaderGap<true>(v->GetX(), v->GetTargetY())
+                          : method == 1 ? lane.LeaderGapScalar<true>(v->GetX(), v->GetTargetY())
+                          : ObjectLeaderGap<true>(vehicles, *v);
+                checksum[method] += std::min(gap, 10000.0f);
+            }
+        }
+        seconds[method] = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    const char* names[3] = { "snapshot kernel", "snapshot scalar", "per-object" };
+    double queries = (double)count * rounds;
+    for (int method = 0; method < 3; ++method) {
+        std::cout << names[method] << ": " << seconds[method] / queries * 1e9 << " ns/query ("
+                  << seconds[2] / std::max(seconds[method], 1e-9) << "x per-object)" << std::endl;
+    }
+    if (checksum[0] != checksum[2] || checksum[1] != checksum[2]) {
+        std::cout << "Leader gaps differ between methods" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Nagel-Schreckenberg cellular automaton for large what-if runs.
+// A lane is a ring of cells: occupancy and obstacles (red signal, accident) are bitsets,
+// speeds are one byte per cell. Gaps come from a bit scan over 64 cells at a time.
+// A lane can also be one open segment of a longer ring split across processes:
+// it then sees the next segment's first 64 cells as a halo and hands over the
+// vehicles that drive past its end.
+struct CellTransfer {
+    uint32_t cell;  // Cell in the receiving segment
+    uint8_t speed;
+};
+
+class CellularLane {
+private:
+    size_t cells;
+    std::vector<uint64_t> occ, nextOcc;
+    std::vector<uint64_t> obstacles;
+    std::vector<uint8_t> vel, nextVel;
+    uint64_t rng;
+    size_t vehicles;
+    bool ring;
+    uint64_t halo;  // Open segment: first 64 cells of the next segment
+
+    uint64_t Random() {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return rng;
+    }
+
+    static void Set(std::vector<uint64_t>& bits, size_t i, bool on) {
+        if (on) bits[i / 64] |= uint64_t(1) << (i % 64);
+        else bits[i / 64] &= ~(uint64_t(1) << (i % 64));
+    }
+
+    uint64_t Word(size_t w) const {
+        if (ring) w %= occ.size();
+        else if (w >= occ.size()) return w == occ.size() ? halo : 0;
+        return occ[w] | obstacles[w];
+    }
+
+    // Cells [start, start + 64) of occupancy | obstacles
+    uint64_t Window(size_t start) const {
+        size_t w = start / 64;
+        size_t b = start % 64;
+        uint64_t lo = Word(w);
+        if (b == 0) return lo;
+        return (lo >> b) | (Word(w + 1) << (64 - b));
+    }
+
+public:
+    // Cell count is rounded up to whole 64-bit words
+    CellularLane(size_t cellCount, size_t vehicleCount, uint64_t seed, bool isRing = true)
+        : cells(((cellCount + 63) / 64) * 64), rng(seed | 1), vehicles(0), ring(isRing), halo(0) {
+        occ.assign(cells / 64, 0);
+        nextOcc.assign(cells / 64, 0);
+        obstacles.assign(cells / 64, 0);
+        vel.assign(cells, 0);
+        nextVel.assign(cells, 0);
+        vehicleCount = std::min(vehicleCount, cells);
+        // Spread vehicles evenly, all starting at rest
+        for (size_t k = 0; k < vehicleCount; ++k) Set(occ, k * cells / vehicleCount, true);
+        vehicles = vehicleCount;
+    }
+
+    size_t Cells() const { return cells; }
+    size_t Vehicles() const { return vehicles; }
+    uint64_t HeadWord() const { return Word(0); }
+    void SetHalo(uint64_t bits) { halo = bits; }
+
+    // Obstacles act like a parked vehicle: nobody drives into or through them
+    void SetObstacle(size_t cell, bool on) { Set(obstacles, cell % cells, on); }
+
+    // Vehicle handed over by the previous segment
+    void Enter(const CellTransfer& t) {
+        Set(occ, t.cell, true);
+        vel[t.cell] = t.speed;
+        vehicles++;
+    }
+
+    // Vehicles leaving an open segment are appended to exits
+    void Step(std::vector<CellTransfer>* exits = nullptr) {
+        std::fill(nextOcc.begin(), nextOcc.end(), 0);
+        for (size_t w = 0; w < occ.size(); ++w) {
+            uint64_t bits = occ[w];
+            uint64_t dawdle = Random() & Random();  // p = 0.25 for each vehicle
+            while (bits) {
+                int b = __builtin_ctzll(bits);
+                bits &= bits - 1;
+                size_t i = w * 64 + b;
+
+                uint64_t ahead = Window(i + 1);
+                int gap = ahead ? __builtin_ctzll(ahead) : 64;
+                int v = std::min(std::min(vel[i] + 1, CA_VMAX), gap);
+                if (v > 0 && ((dawdle >> b) & 1u)) v--;
+
+                size_t j = i + v;
+                if (j >= cells) {
+                    if (!ring) {
+                        if (exits) exits->push_back({ (uint32_t)(j - cells), (uint8_t)v });
+                        vehicles--;
+                        continue;
+                    }
+                    j -= cells;
+                }
+                Set(nextOcc, j, true);
+                nextVel[j] = (uint8_t)v;
+            }
+        }
+        occ.swap(nextOcc);
+        vel.swap(nextVel);
+    }
+
+    // Sum of speeds (cells per step) over all vehicles
+    size_t TotalSpeed() const {
+        size_t total = 0;
+        for (size_t w = 0; w < occ.size(); ++w) {
+            uint64_t bits = occ[w];
+            while (bits) {
+                total += vel[w * 64 + __builtin_ctzll(bits)];
+                bits &= bits - 1;
+            }
+        }
+        return total;
+    }
+};
+
+// Layout shared by every cellular run: two roads of three lanes, one signal per
+// road, an accident in the bottom middle lane. Cells are counted along the whole ring.
+struct CellularScenario {
+    static constexpr size_t LANES = 6;
+    size_t cellsPerLane;
+    size_t vehicleCount;
+    size_t vehiclesPerLane;
+    size_t stopTop, stopBottom, accidentCell;
+    TrafficLight lightTop;
+    TrafficLight lightBottom;
+
+    CellularScenario(size_t totalVehicles, size_t segments)
+        : vehicleCount(totalVehicles),
+          lightTop(SCREEN_WIDTH / 2 - 80, ROAD_Y_TOP - 80, 5.0f),
+          lightBottom(SCREEN_WIDTH / 2 - 150, ROAD_Y_BOTTOM + ROAD_HEIGHT + 20, 5.0f) {
+        const double density = 0.2;
+        vehiclesPerLane = vehicleCount / LANES;
+        size_t segmentCells = (size_t)(vehiclesPerLane / density / segments) + 64;
+        cellsPerLane = ((segmentCells + 63) / 64) * 64 * segments;
+        // Map the screen positions onto the ring; the bottom road runs right to left
+        stopTop = (size_t)(lightTop.GetStopLineX(false) / SCREEN_WIDTH * cellsPerLane);
+        stopBottom = cellsPerLane - 1 - (size_t)(lightBottom.GetStopLineX(true) / SCREEN_WIDTH * cellsPerLane);
+        accidentCell = cellsPerLane / 3;
+    }
+
+    // Vehicles in lane l; the last lane takes what does not divide evenly
+    size_t LaneVehicles(size_t l) const {
+        return vehiclesPerLane + (l == LANES - 1 ? vehicleCount % LANES : 0);
+    }
+
+    // Vehicles of lane l in one of 'parts' segments; the last segment takes the remainder
+    size_t SegmentVehicles(size_t l, int part, int parts) const {
+        size_t n = LaneVehicles(l);
+        return n / parts + (part == parts - 1 ? n % parts : 0);
+    }
+
+    // One step is one second of simulated time. Obstacles are applied to cells
+    // in [first, first + count) of the ring.
+    void Advance(std::vector<CellularLane>& lanes, size_t first, size_t count) {
+        lightTop.Update(1.0f);
+        lightBottom.Update(1.0f);
+        for (size_t l = 0; l < LANES; ++l) {
+            bool top = l < 3;
+            size_t stop = top ? stopTop : stopBottom;
+            if (stop >= first && stop < first + count)
+                lanes[l].SetObstacle(stop - first, top ? lightTop.IsRed() : lightBottom.IsRed());
+            if (l == 4 && accidentCell >= first && accidentCell < first + count)
+                lanes[l].SetObstacle(accidentCell - first, true);
+        }
     }
 };
 
-int main() {
+static void PrintCellularResult(size_t total, size_t speed, int steps, double seconds) {
+    std::cout << "Cellular mode: " << total << " vehicles, " << steps << " steps in " << seconds << " s ("
+              << (total * steps / std::max(seconds, 1e-9)) / 1e6 << " M vehicle-steps/s), mean speed "
+              << (total ? (double)speed / total : 0.0) << " cells/step" << std::endl;
+}
+
+// Headless run of the cellular engine on one process
+int RunCellularMode(size_t vehicleCount, int steps) {
+    CellularScenario scenario(vehicleCount, 1);
+    std::vector<CellularLane> lanes;
+    for (size_t l = 0; l < CellularScenario::LANES; ++l)
+        lanes.emplace_back(scenario.cellsPerLane, scenario.LaneVehicles(l), 0x9E3779B97F4A7C15ull * (l + 1));
+
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < steps; ++t) {
+        scenario.Advance(lanes, 0, scenario.cellsPerLane);
+        for (auto& lane : lanes) lane.Step();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t total = 0, speed = 0;
+    for (auto& lane : lanes) { total += lane.Vehicles(); speed += lane.TotalSpeed(); }
+    PrintCellularResult(total, speed, steps, seconds);
+    return 0;
+}
+
+#ifdef __linux__
+// Same run split across local processes. Each process owns one segment of every
+// lane ring. Per tick it publishes its head cells (the upstream halo), waits on a
+// process-shared barrier, steps, posts leaving vehicles to the next segment's mailbox,
+// and waits again before taking in its own arrivals. The parent only supervises:
+// if any partition fails, the others would wait on the barrier forever, so it kills them.
+constexpr int CA_MAX_PROCS = 64;
+constexpr int CA_MAILBOX_SIZE = CA_VMAX + 1; // At most one vehicle per cell crosses per step
+
+struct CellMailbox {
+    uint32_t count;
+    CellTransfer items[CA_MAILBOX_SIZE];
+};
+
+struct CellularShared {
+    pthread_barrier_t barrier;
+    uint64_t head[CA_MAX_PROCS][CellularScenario::LANES];
+    CellMailbox inbox[CA_MAX_PROCS][CellularScenario::LANES];
+    uint64_t vehicles[CA_MAX_PROCS];
+    uint64_t totalSpeed[CA_MAX_PROCS];
+};
+
+static void RunCellularPartition(CellularShared* shared, int part, int parts, size_t vehicleCount, int steps) {
+    CellularScenario scenario(vehicleCount, parts);
+    const size_t segCells = scenario.cellsPerLane / parts;
+    const int next = (part + 1) % parts;
+
+    std::vector<CellularLane> lanes;
+    for (size_t l = 0; l < CellularScenario::LANES; ++l)
+        lanes.emplace_back(segCells, scenario.SegmentVehicles(l, part, parts),
+                           0x9E3779B97F4A7C15ull * (l + 1) + part, false);
+
+    std::vector<CellTransfer> exits;
+    for (int t = 0; t < steps; ++t) {
+        scenario.Advance(lanes, part * segCells, segCells);
+        for (size_t l = 0; l < lanes.size(); ++l) shared->head[part][l] = lanes[l].HeadWord();
+        pthread_barrier_wait(&shared->barrier);
+
+        for (size_t l = 0; l < lanes.size(); ++l) {
+            lanes[l].SetHalo(shared->head[next][l]);
+            exits.clear();
+            lanes[l].Step(&exits);
+            CellMailbox& box = shared->inbox[next][l];
+            for (size_t k = 0; k < exits.size(); ++k) box.items[k] = exits[k];
+            box.count = (uint32_t)exits.size();
+        }
+        pthread_barrier_wait(&shared->barrier);
+
+        for (size_t l = 0; l < lanes.size(); ++l) {
+            CellMailbox& box = shared->inbox[part][l];
+            for (uint32_t k = 0; k < box.count; ++k) lanes[l].Enter(box.items[k]);
+            box.count = 0;
+        }
+    }
+
+    shared->vehicles[part] = 0;
+    shared->totalSpeed[part] = 0;
+    for (auto& lane : lanes) {
+        shared->vehicles[part] += lane.Vehicles();
+        shared->totalSpeed[part] += lane.TotalSpeed();
+    }
+}
+
+int RunCellularProcesses(size_t vehicleCount, int steps, int parts) {
+    parts = std::max(1, std::min(parts, CA_MAX_PROCS));
+    void* memory = mmap(nullptr, sizeof(CellularShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        std::cout << "Cellular mode: shared memory unavailable" << std::endl;
+        return 1;
+    }
+    CellularShared* shared = new (memory) CellularShared();
+    pthread_barrierattr_t attr;
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&shared->barrier, &attr, parts);
+    pthread_barrierattr_destroy(&attr);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<pid_t> children;
+    bool failed = false;
+    for (int p = 0; p < parts && !failed; ++p) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            RunCellularPartition(shared, p, parts, vehicleCount, steps);
+            _exit(0);
+        }
+        if (pid < 0) failed = true;
+        else children.push_back(pid);
+    }
+
+    // A partition that died (or could not start) leaves the rest blocked on the barrier
+    if (failed) for (pid_t pid : children) kill(pid, SIGKILL);
+    while (!children.empty()) {
+        int status = 0;
+        pid_t pid = wait(&status);
+        if (pid < 0) break;
+        children.erase(std::remove(children.begin(), children.end(), pid), children.end());
+        if (!failed && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+            failed = true;
+            for (pid_t other : children) kill(other, SIGKILL);
+        }
+    }
+    if (failed) {
+        std::cout << "Cellular mode: a partition process failed" << std::endl;
+        // Not destroying the barrier: killed processes never left it, so destroy would block
+        munmap(memory, sizeof(CellularShared));
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Merge in partition order so the totals do not depend on which process finished first
+    size_t total = 0, speed = 0;
+    for (int p = 0; p < parts; ++p) { total += shared->vehicles[p]; speed += shared->totalSpeed[p]; }
+    PrintCellularResult(total, speed, steps, seconds);
+
+    pthread_barrier_destroy(&shared->barrier);
+    munmap(memory, sizeof(CellularShared));
+    return 0;
+}
+#endif
+
+int main(int argc, char** argv) {
+    // Assets sit next to the executable, whatever directory it was started from
+    ChangeDirectory(GetApplicationDirectory());
+
+    // --pack-assets: decode every texture and sound into one pack file, then exit
+    if (argc >= 2 && strcmp(argv[1], "--pack-assets") == 0) {
+        bool ok = AssetCache::WritePack();
+        std::cout << (ok ? "Wrote " : "Could not write ") << ASSET_PACK_FILE << std::endl;
+        return ok ? 0 : 1;
+    }
+
+    // --cells <vehicles> [steps] [processes]: headless cellular automaton run, no window
+    if (argc >= 3 && strcmp(argv[1], "--cells") == 0) {
+        size_t vehicles = strtoul(argv[2], nullptr, 10);
+        int steps = argc >= 4 ? atoi(argv[3]) : 1000;
+#ifdef __linux__
+        if (argc >= 5 && atoi(argv[4]) > 1) return RunCellularProcesses(vehicles, steps, atoi(argv[4]));
+#endif
+        return RunCellularMode(vehicles, steps);
+    }
+
+    // --env-bench <environments> [steps]: headless signal-control environments, no window
+    if (argc >= 3 && strcmp(argv[1], "--env-bench") == 0) {
+        return RunEnvBenchmark(strtoul(argv[2], nullptr, 10), argc >= 4 ? atol(argv[3]) : 1000);
+    }
+
+    // --bench [vehicles] [rounds]: time the leader search, no window
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+        return RunGapBenchmark(argc >= 3 ? strtoul(argv[2], nullptr, 10) : 256, argc >= 4 ? atol(argv[3]) : 200);
+    }
+
+    // --no-alloc-after <frames>: abort on any update/draw heap allocation after warm-up
+    long allocWarmupFrames = -1;
+    if (argc >= 3 && strcmp(argv[1], "--no-alloc-after") == 0) allocWarmupFrames = atol(argv[2]);
+
+    // --capture <frames> [prefix]: render frames offscreen at the fixed simulation rate
+    // in a hidden window, as fast as they can be encoded
+    if (argc >= 3 && strcmp(argv[1], "--capture") == 0) {
+        long frames = atol(argv[2]);
+        SetConfigFlags(FLAG_WINDOW_HIDDEN);
+        InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Traffic Sim capture");
+        {
+            Simulation sim;
+            sim.Init();
+            sim.WaitForAssets();
+            sim.StartRecording(argc >= 4 ? argv[3] : "capture_");
+            auto start = std::chrono::steady_clock::now();
+            for (long i = 0; i < frames; ++i) {
+                BeginDrawing();
+                sim.Update(1.0f / TARGET_FPS);
+                sim.CaptureFrame();
+                EndDrawing();
+            }
+            sim.StopRecording();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Captured " << frames << " frames in " << seconds << " s ("
+                      << frames / seconds << " fps)" << std::endl;
+        }
+        CloseWindow();
+        return 0;
+    }
+
     InitAudioDevice();
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Traffic Sim: Accidents & Ambulance");
-    SetTargetFPS(60);
+    SetTargetFPS(TARGET_FPS);
     
     {
         Simulation sim;
         sim.Init();
+        FrameGovernor governor;
+        RenderTexture2D heldFrame = {};  // Shown again on frames the governor does not redraw
+        bool holding = false;            // heldFrame is up to date from the previous frame
+        long frame = 0;
         while (!WindowShouldClose()) {
+            if (frame++ == allocWarmupFrames) AllocTracker::ForbidSteadyState(true);
+
+            using Clock = std::chrono::steady_clock;
+            auto ms = [](Clock::time_point a, Clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+
             float delta = GetFrameTime();
+            AllocTracker::SetPhase(PHASE_UPDATE);
+            auto updateStart = Clock::now();
             sim.Update(delta);
-            BeginDrawing();
-            ClearBackground(SKYBLUE);
-            sim.Draw();
+            AllocTracker::SetPhase(PHASE_DRAW);
+            auto drawStart = Clock::now();
+            if (governor.HoldsFrames()) {
+                if (heldFrame.id == 0) heldFrame = LoadRenderTexture(SCREEN_WIDTH, SCREEN_HEIGHT);
+                if (!holding || governor.DrawThisFrame()) {
+                    BeginTextureMode(heldFrame);
+                    ClearBackground(SKYBLUE);
+                    sim.Draw();
+                    EndTextureMode();
+                }
+                BeginDrawing();
+                DrawTextureRec(heldFrame.texture, { 0, 0, (float)SCREEN_WIDTH, -(float)SCREEN_HEIGHT }, { 0, 0 }, WHITE);
+            } else {
+                BeginDrawing();
+                ClearBackground(SKYBLUE);
+                sim.Draw();
+            }
+            holding = governor.HoldsFrames();
+            rlDrawRenderBatchActive();  // Submit the batched draw calls here so their cost counts as draw time
+            auto drawEnd = Clock::now();  // EndDrawing also waits for the frame limiter, so it is not counted
             EndDrawing();
+            AllocTracker::SetPhase(PHASE_OTHER);
+            auto captureStart = Clock::now();
+            sim.CaptureFrame();
+            governor.Record(ms(updateStart, drawStart), ms(drawStart, drawEnd), ms(captureStart, Clock::now()));
+            sim.ApplyGovernor(governor);
+            AllocTracker::EndFrame();
+
+            sim.ZoomCamera();
             if (IsKeyPressed(KEY_E)) sim.CallAmbulance();
             if (IsKeyPressed(KEY_D)) sim.CallDepannage();
-            if (IsKeyPressed(KEY_A)) sim.TriggerRandomAccident();
+            if (IsKeyPressed(KEY_A) && sim.TriggerRandomAccident()) std::cout << "Accident Pending initiated!" << std::endl;
+            if (IsKeyPressed(KEY_R)) sim.ToggleRecording();
+            if (IsKeyPressed(KEY_T)) sim.ToggleDiagram();
+            if (IsKeyPressed(KEY_H)) sim.ToggleHeatmap();
+            if (IsKeyPressed(KEY_G)) sim.ToggleCharts();
+            if (IsKeyPressed(KEY_X)) sim.ExportMetrics();
         }
+        AllocTracker::ForbidSteadyState(false);
+        if (heldFrame.id) UnloadRenderTexture(heldFrame);
     } 
 
     CloseAudioDevice();